@@ -1,4 +1,9 @@
+#include "threads/thread_pool.hpp"
+
+#include <iostream>
+
 int main(int argc, char* argv[])
 {
+    Threads::DumpThreadPoolMetrics(std::cout);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,67 @@
+#include "allocation_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<int> g_activeScopes = 0;
+    std::atomic<size_t> g_allocations = 0;
+
+    void countAllocation() noexcept
+    {
+        if (g_activeScopes.load(std::memory_order_relaxed) > 0)
+            g_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+namespace Threads
+{
+    void StartCountingAllocations() noexcept { g_activeScopes.fetch_add(1); }
+    void StopCountingAllocations() noexcept { g_activeScopes.fetch_sub(1); }
+    size_t CountedAllocations() noexcept { return g_allocations.load(); }
+}
+
+// The array and nothrow forms forward to these by default
+void* operator new(std::size_t size)
+{
+    countAllocation();
+    if (void* memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    countAllocation();
+    const size_t align = static_cast<size_t>(alignment);
+#if defined(_MSC_VER)
+    void* memory = _aligned_malloc(size ? size : 1, align);
+#else
+    // aligned_alloc() wants the size to be a multiple of the alignment
+    void* memory = std::aligned_alloc(align, ((size ? size : 1) + align - 1) / align * align);
+#endif
+    if (memory)
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+#if defined(_MSC_VER)
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
@@ -0,0 +1,37 @@
+#pragma once
+#ifndef THREADS_ALLOCATION_COUNTER_HPP_
+#define THREADS_ALLOCATION_COUNTER_HPP_
+
+#include <cstddef>
+
+namespace Threads
+{
+    // Implemented in allocation_counter.cpp, next to the replaced global operator new
+    void StartCountingAllocations() noexcept;
+    void StopCountingAllocations() noexcept;
+    size_t CountedAllocations() noexcept;
+
+    // Counts every call of the global operator new, on any thread, while it is alive.
+    // Outside of such a scope the replaced operator pays one relaxed load per call.
+    class HeapAllocationScope
+    {
+    public:
+        HeapAllocationScope() noexcept
+        {
+            StartCountingAllocations();
+            m_start = CountedAllocations();
+        }
+
+        ~HeapAllocationScope() { StopCountingAllocations(); }
+
+        HeapAllocationScope(const HeapAllocationScope&) = delete;
+        HeapAllocationScope& operator=(const HeapAllocationScope&) = delete;
+
+        size_t Allocations() const noexcept { return CountedAllocations() - m_start; }
+
+    private:
+        size_t m_start = 0;
+    };
+}
+
+#endif // THREADS_ALLOCATION_COUNTER_HPP_
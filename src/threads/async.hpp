@@ -1,5 +1,7 @@
 #pragma once
 
+#include "simd_reduce.hpp"
+
 #include <algorithm>
 #include <future>
 #include <iostream>
@@ -34,16 +36,18 @@ namespace Threads::Async
         }
     };
     
+    // The sum is accumulated in a wider type than the elements (int64_t for int),
+    // and the leaves run the vectorized kernel instead of a scalar loop
     template<typename RandomIt>
-    int ParallelSum(RandomIt beg, RandomIt end)
+    Simd::SumType<std::iter_value_t<RandomIt>> ParallelSum(RandomIt beg, RandomIt end)
     {
         auto len = end - beg;
         if (len < 1000)
-            return std::accumulate(beg, end, 0);
+            return Simd::Sum(beg, end);
     
         RandomIt mid = beg + len / 2;
         auto handle = std::async(std::launch::async, ParallelSum<RandomIt>, mid, end);
-        int sum = ParallelSum(beg, mid);
+        auto sum = ParallelSum(beg, mid);
         return sum + handle.get();
     }
     
@@ -0,0 +1,780 @@
+#pragma once
+#ifndef THREADS_ASYNC_FILE_HPP_
+#define THREADS_ASYNC_FILE_HPP_
+
+#include "coroutine_executor.hpp"
+#include "simd_scan.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <semaphore>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define THREADS_ASYNC_FILE_POSIX 1
+#else
+    #define THREADS_ASYNC_FILE_POSIX 0
+#endif
+
+// io_uring through its raw system calls, no liburing needed
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #include <sys/mman.h>
+        #include <sys/syscall.h>
+        #include <sys/uio.h>
+        #define THREADS_ASYNC_FILE_IO_URING 1
+    #endif
+#endif
+#ifndef THREADS_ASYNC_FILE_IO_URING
+    #define THREADS_ASYNC_FILE_IO_URING 0
+#endif
+
+namespace Threads
+{
+    // Read-only file for AsyncIo: positional reads, no shared file offset, so any number
+    // of reads can be in flight at once
+    class AsyncFile
+    {
+    public:
+        explicit AsyncFile(const std::string& path)
+        {
+#if THREADS_ASYNC_FILE_POSIX
+            m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (m_fd < 0)
+                throw std::system_error(errno, std::generic_category(), "AsyncFile: open " + path);
+            struct stat info;
+            if (::fstat(m_fd, &info) != 0)
+            {
+                int error = errno;
+                ::close(m_fd);
+                throw std::system_error(error, std::generic_category(), "AsyncFile: stat " + path);
+            }
+            m_size = static_cast<uint64_t>(info.st_size);
+    #if defined(__linux__)
+            ::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    #endif
+#else
+            m_stream = std::make_unique<std::ifstream>(path, std::ios::binary);
+            if (!*m_stream)
+                throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory), "AsyncFile: open " + path);
+            m_size = std::filesystem::file_size(path);
+            m_streamMutex = std::make_unique<std::mutex>();
+#endif
+        }
+
+        ~AsyncFile()
+        {
+#if THREADS_ASYNC_FILE_POSIX
+            if (m_fd >= 0)
+                ::close(m_fd);
+#endif
+        }
+
+        AsyncFile(AsyncFile&& other) noexcept
+            : m_size(other.m_size),
+#if THREADS_ASYNC_FILE_POSIX
+              m_fd(std::exchange(other.m_fd, -1))
+#else
+              m_stream(std::move(other.m_stream)), m_streamMutex(std::move(other.m_streamMutex))
+#endif
+        {
+        }
+
+        AsyncFile(const AsyncFile&) = delete;
+        AsyncFile& operator=(const AsyncFile&) = delete;
+        AsyncFile& operator=(AsyncFile&&) = delete;
+
+        uint64_t Size() const { return m_size; }
+
+#if THREADS_ASYNC_FILE_POSIX
+        int Descriptor() const { return m_fd; }
+#endif
+
+        // Bytes read, or -errno. What the thread-pool backend runs on a worker.
+        int64_t ReadBlocking(std::span<char> buffer, uint64_t offset) const
+        {
+#if THREADS_ASYNC_FILE_POSIX
+            ssize_t result;
+            do
+            {
+                result = ::pread(m_fd, buffer.data(), buffer.size(), static_cast<off_t>(offset));
+            } while (result < 0 && errno == EINTR);
+            return result < 0 ? -errno : result;
+#else
+            // No positional reads: one stream, one read at a time
+            std::lock_guard<std::mutex> lock(*m_streamMutex);
+            m_stream->clear();
+            m_stream->seekg(static_cast<std::streamoff>(offset));
+            m_stream->read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            return m_stream->bad() ? -EIO : static_cast<int64_t>(m_stream->gcount());
+#endif
+        }
+
+    private:
+        uint64_t m_size = 0;
+#if THREADS_ASYNC_FILE_POSIX
+        int m_fd = -1;
+#else
+        std::unique_ptr<std::ifstream> m_stream;
+        std::unique_ptr<std::mutex> m_streamMutex;
+#endif
+    };
+
+    class AsyncIo;
+
+    // One positional read: Start() issues it, co_await waits for it and yields the byte
+    // count (short only at end of file, as a rule). Started reads can be awaited in any
+    // order, which is how a reader keeps several in flight. Must stay put until it finished.
+    class ReadOperation
+    {
+    public:
+        ReadOperation() = default;
+        ReadOperation(const ReadOperation&) = delete;
+        ReadOperation& operator=(const ReadOperation&) = delete;
+
+        void Start(AsyncIo& io, const AsyncFile& file, std::span<char> buffer, uint64_t offset);
+
+        bool await_ready() const noexcept { return m_state.load(std::memory_order_acquire) == Done; }
+
+        // Fails, and so resumes right away, if the read completed meanwhile
+        bool await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            m_handle = handle;
+            uint8_t expected = Running;
+            return m_state.compare_exchange_strong(expected, Waiting, std::memory_order_acq_rel, std::memory_order_acquire);
+        }
+
+        size_t await_resume() const
+        {
+            if (m_result < 0)
+                throw std::system_error(static_cast<int>(-m_result), std::generic_category(), "AsyncFile: read");
+            return static_cast<size_t>(m_result);
+        }
+
+        // For destructors that can't co_await: blocks until the read is done
+        void WaitBlocking() const
+        {
+            while (m_state.load(std::memory_order_acquire) == Running)
+                std::this_thread::yield();
+        }
+
+
+    private:
+        friend class AsyncIo;
+
+        static constexpr uint8_t Idle = 0;
+        static constexpr uint8_t Running = 1;
+        static constexpr uint8_t Waiting = 2;
+        static constexpr uint8_t Done = 3;
+
+        // Nothing of the operation is touched after the state changed, the awaiter may be
+        // gone right after
+        void complete(int64_t result, ThreadPool* resumeOn)
+        {
+            m_result = result;
+            if (m_state.exchange(Done, std::memory_order_acq_rel) == Waiting)
+            {
+                std::coroutine_handle<> handle = m_handle;
+                if (resumeOn)
+                    resumeOn->Enqueue([handle] { handle.resume(); });
+                else
+                    handle.resume();
+            }
+        }
+
+        std::atomic<uint8_t> m_state = Idle;
+        std::coroutine_handle<> m_handle;
+        int64_t m_result = 0;
+#if THREADS_ASYNC_FILE_IO_URING
+        iovec m_iovec { };
+        // Reads the kernel holds, so that a failing ring can fail them
+        ReadOperation* m_prevInFlight = nullptr;
+        ReadOperation* m_nextInFlight = nullptr;
+#endif
+    };
+
+    enum class IoBackend
+    {
+        // Linux io_uring: the kernel does the reads, one thread reaps completions
+        IoUring,
+        // Blocking positional reads on pool workers
+        ThreadPool
+    };
+
+    // Runs ReadOperations and resumes their coroutines on a ThreadPool. Prefers io_uring and
+    // falls back to the pool itself where io_uring isn't available: older kernels, other
+    // systems, or a seccomp filter that blocks it. A ring that stops working later fails
+    // the reads it holds and hands all further ones to the pool as well. Outlives every
+    // operation it started.
+    class AsyncIo
+    {
+    public:
+        explicit AsyncIo(ThreadPool& pool, IoBackend preferred = IoBackend::IoUring, unsigned queueDepth = 64)
+            : m_pool(pool), m_backend(IoBackend::ThreadPool), m_inFlight(std::max(queueDepth, 1u))
+        {
+#if THREADS_ASYNC_FILE_IO_URING
+            if (preferred == IoBackend::IoUring && setupRing(std::max(queueDepth, 1u)))
+            {
+                m_backend = IoBackend::IoUring;
+                m_reaper = std::thread([this] { reap(); });
+            }
+#else
+            (void)preferred;
+#endif
+        }
+
+        ~AsyncIo()
+        {
+#if THREADS_ASYNC_FILE_IO_URING
+            if (m_reaper.joinable())
+            {
+                // A no-op without an operation tells the reaper to stop. Once the ring
+                // has failed it isn't submitted, but then the reaper has returned already.
+                m_stopping.store(true);
+                submit([](io_uring_sqe& sqe) { sqe.opcode = IORING_OP_NOP; sqe.user_data = 0; });
+                m_reaper.join();
+                teardownRing();
+            }
+#endif
+        }
+
+        AsyncIo(const AsyncIo&) = delete;
+        AsyncIo& operator=(const AsyncIo&) = delete;
+
+        IoBackend Backend() const { return m_backend.load(std::memory_order_acquire); }
+        ThreadPool& Pool() { return m_pool; }
+
+        void Read(ReadOperation& operation, const AsyncFile& file, std::span<char> buffer, uint64_t offset)
+        {
+            operation.m_state.store(ReadOperation::Running, std::memory_order_relaxed);
+#if THREADS_ASYNC_FILE_IO_URING
+            if (Backend() == IoBackend::IoUring)
+            {
+                // At most queueDepth reads in flight, so the completion queue can't overflow
+                m_inFlight.acquire();
+                operation.m_iovec = { buffer.data(), buffer.size() };
+                const int error = submit([&](io_uring_sqe& sqe)
+                {
+                    sqe.opcode = IORING_OP_READV;
+                    sqe.fd = file.Descriptor();
+                    sqe.addr = reinterpret_cast<uint64_t>(&operation.m_iovec);
+                    sqe.len = 1;
+                    sqe.off = offset;
+                    sqe.user_data = reinterpret_cast<uint64_t>(&operation);
+                }, &operation);
+                if (error == 0)
+                    return;
+
+                m_inFlight.release();
+                // The ring failed for good meanwhile: read on the pool like everybody else
+                if (Backend() == IoBackend::IoUring)
+                {
+                    operation.complete(error, nullptr);
+                    return;
+                }
+            }
+#endif
+            m_pool.Enqueue([&operation, &file, buffer, offset]
+            {
+                // Already on a worker: resume right here
+                operation.complete(file.ReadBlocking(buffer, offset), nullptr);
+            });
+        }
+
+    private:
+#if THREADS_ASYNC_FILE_IO_URING
+        static int ioUringSetup(unsigned entries, io_uring_params* params)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+        }
+
+        static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+        }
+
+        bool setupRing(unsigned entries)
+        {
+            io_uring_params params { };
+            m_ringFd = ioUringSetup(entries, &params);
+            if (m_ringFd < 0)
+                return false;
+
+            m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (singleMap)
+                m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+            m_sqRing = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+            m_cqRing = singleMap ? m_sqRing
+                                 : ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+            m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            void* sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+            if (m_sqRing == MAP_FAILED || m_cqRing == MAP_FAILED || sqes == MAP_FAILED)
+            {
+                m_sqes = sqes == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(sqes);
+                teardownRing();
+                return false;
+            }
+            m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+            char* sq = static_cast<char*>(m_sqRing);
+            m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+            m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+            char* cq = static_cast<char*>(m_cqRing);
+            m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            return true;
+        }
+
+        void teardownRing()
+        {
+            if (m_sqes)
+                ::munmap(m_sqes, m_sqesSize);
+            if (m_cqRing && m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+                ::munmap(m_cqRing, m_cqRingSize);
+            if (m_sqRing && m_sqRing != MAP_FAILED)
+                ::munmap(m_sqRing, m_sqRingSize);
+            ::close(m_ringFd);
+        }
+
+        // The ring is shared with the kernel: head and tail go through atomic_ref. Every
+        // entry is handed over right away, so the submission queue never fills up.
+        // Returns 0, or -errno when the kernel refused the entry or the ring has failed.
+        template <typename F>
+        int submit(F&& prepare, ReadOperation* operation = nullptr)
+        {
+            std::lock_guard<std::mutex> lock(m_submitMutex);
+            if (m_ringError != 0)
+                return m_ringError;
+
+            const unsigned tail = *m_sqTail;
+            const unsigned index = tail & m_sqMask;
+            io_uring_sqe& sqe = m_sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            prepare(sqe);
+            // Pairs with the acquire in reap(). The ring already orders our writes before
+            // the completion, but only the kernel sees that, ThreadSanitizer doesn't.
+            m_submitted.fetch_add(1, std::memory_order_release);
+            m_sqArray[index] = index;
+            std::atomic_ref<unsigned>(*m_sqTail).store(tail + 1, std::memory_order_release);
+
+            while (ioUringEnter(m_ringFd, 1, 0, 0) < 0)
+            {
+                const int error = errno;
+                if (error != EINTR && error != EAGAIN && error != EBUSY)
+                {
+                    // A failed call submits nothing, and only we hand entries to the
+                    // kernel, so the entry is still ours to take back
+                    std::atomic_ref<unsigned>(*m_sqTail).store(tail, std::memory_order_release);
+                    return -error;
+                }
+                std::this_thread::yield();
+            }
+
+            if (operation)
+            {
+                operation->m_prevInFlight = nullptr;
+                operation->m_nextInFlight = m_inFlightHead;
+                if (m_inFlightHead)
+                    m_inFlightHead->m_prevInFlight = operation;
+                m_inFlightHead = operation;
+            }
+            return 0;
+        }
+
+        // Called with m_submitMutex held, before the read is completed
+        void untrack(ReadOperation& operation)
+        {
+            if (operation.m_prevInFlight)
+                operation.m_prevInFlight->m_nextInFlight = operation.m_nextInFlight;
+            else
+                m_inFlightHead = operation.m_nextInFlight;
+            if (operation.m_nextInFlight)
+                operation.m_nextInFlight->m_prevInFlight = operation.m_prevInFlight;
+        }
+
+        // The reaper can't wait for completions any more: fail every read the kernel
+        // still holds and send new ones to the pool, so that nobody waits forever
+        void failRing(int error)
+        {
+            ReadOperation* pending = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_submitMutex);
+                m_ringError = error;
+                m_backend.store(IoBackend::ThreadPool, std::memory_order_release);
+                pending = std::exchange(m_inFlightHead, nullptr);
+            }
+
+            while (pending)
+            {
+                ReadOperation* next = pending->m_nextInFlight;
+                m_inFlight.release();
+                pending->complete(error, &m_pool);
+                pending = next;
+            }
+        }
+
+        void reap()
+        {
+            NameCurrentThread("io_uring reaper");
+            while (true)
+            {
+                if (ioUringEnter(m_ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+                {
+                    failRing(-errno);
+                    return;
+                }
+
+                unsigned head = *m_cqHead;
+                const unsigned tail = std::atomic_ref<unsigned>(*m_cqTail).load(std::memory_order_acquire);
+                m_submitted.load(std::memory_order_acquire);
+                {
+                    // Completing may free the operation, so it leaves the list first
+                    std::lock_guard<std::mutex> lock(m_submitMutex);
+                    for (unsigned entry = head; entry != tail; ++entry)
+                    {
+                        if (const uint64_t data = m_cqes[entry & m_cqMask].user_data)
+                            untrack(*reinterpret_cast<ReadOperation*>(data));
+                    }
+                }
+
+                bool stop = false;
+                for (; head != tail; ++head)
+                {
+                    const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+                    if (cqe.user_data == 0)
+                    {
+                        stop = m_stopping.load();
+                        continue;
+                    }
+                    auto* operation = reinterpret_cast<ReadOperation*>(cqe.user_data);
+                    const int64_t result = cqe.res;
+                    m_inFlight.release();
+                    operation->complete(result, &m_pool);
+                }
+                std::atomic_ref<unsigned>(*m_cqHead).store(head, std::memory_order_release);
+                if (stop)
+                    break;
+            }
+        }
+
+        int m_ringFd = -1;
+        void* m_sqRing = nullptr;
+        void* m_cqRing = nullptr;
+        size_t m_sqRingSize = 0;
+        size_t m_cqRingSize = 0;
+        size_t m_sqesSize = 0;
+        io_uring_sqe* m_sqes = nullptr;
+        unsigned* m_sqHead = nullptr;
+        unsigned* m_sqTail = nullptr;
+        unsigned* m_sqArray = nullptr;
+        unsigned m_sqMask = 0;
+        unsigned* m_cqHead = nullptr;
+        unsigned* m_cqTail = nullptr;
+        io_uring_cqe* m_cqes = nullptr;
+        unsigned m_cqMask = 0;
+        std::mutex m_submitMutex;
+        // Both guarded by m_submitMutex
+        ReadOperation* m_inFlightHead = nullptr;
+        int m_ringError = 0;
+        std::atomic<uint64_t> m_submitted = 0;
+        std::atomic<bool> m_stopping = false;
+        std::thread m_reaper;
+#endif
+
+        ThreadPool& m_pool;
+        std::atomic<IoBackend> m_backend;
+        std::counting_semaphore<> m_inFlight;
+    };
+
+    inline void ReadOperation::Start(AsyncIo& io, const AsyncFile& file, std::span<char> buffer, uint64_t offset)
+    {
+        io.Read(*this, file, buffer, offset);
+    }
+
+    // Splits a file into lines without copying them: reads go into large page-aligned
+    // blocks, several in flight ahead of the consumer, and lines are string_views into
+    // those blocks. Only a line that straddles two blocks is copied, into one small
+    // string. Lines come without their '\n'.
+    class AsyncLineReader
+    {
+    public:
+        AsyncLineReader(AsyncIo& io, const AsyncFile& file, size_t blockSize = size_t(1) << 20, size_t readAhead = 4)
+            : m_io(io), m_file(file), m_blockSize(std::max<size_t>(blockSize, 4096)),
+              m_blockCount(std::max<size_t>(readAhead, 1) + 1), m_blocks(std::make_unique<Block[]>(m_blockCount))
+        {
+            for (size_t i = 0; i < m_blockCount; ++i)
+            {
+                m_blocks[i].Data.reset(static_cast<char*>(::operator new[](m_blockSize, std::align_val_t(BlockAlignment))));
+                issue(m_blocks[i]);
+            }
+        }
+
+        // Reads still in flight write into our blocks
+        ~AsyncLineReader()
+        {
+            for (size_t i = 0; i < m_blockCount; ++i)
+            {
+                if (m_blocks[i].Issued)
+                    m_blocks[i].Read.WaitBlocking();
+            }
+        }
+
+        AsyncLineReader(const AsyncLineReader&) = delete;
+        AsyncLineReader& operator=(const AsyncLineReader&) = delete;
+
+        // The lines of the next block. The views stay valid until the next call; an empty
+        // span means the whole file has been read.
+        Coroutines::Task<std::span<const std::string_view>> NextLines()
+        {
+            m_lines.clear();
+            while (true)
+            {
+                // The caller is done with the previous block: read ahead into it
+                if (m_consumed)
+                {
+                    issue(*m_consumed);
+                    m_consumed = nullptr;
+                }
+
+                Block& block = m_blocks[m_next];
+                if (!block.Issued)
+                {
+                    if (!m_carry.empty())
+                    {
+                        m_joined = std::move(m_carry);
+                        m_carry.clear();
+                        m_lines.push_back(m_joined);
+                    }
+                    co_return std::span<const std::string_view>(m_lines);
+                }
+
+                size_t size = co_await block.Read;
+                // Short reads before the end are legal, fetch the rest
+                while (size < block.Size)
+                {
+                    block.Read.Start(m_io, m_file, { block.Data.get() + size, block.Size - size }, block.Offset + size);
+                    size_t more = co_await block.Read;
+                    if (more == 0)
+                        break;
+                    size += more;
+                }
+                block.Issued = false;
+                m_consumed = &block;
+                m_next = (m_next + 1) % m_blockCount;
+
+                split(std::string_view(block.Data.get(), size));
+                if (!m_lines.empty())
+                    co_return std::span<const std::string_view>(m_lines);
+            }
+        }
+
+    private:
+        static constexpr size_t BlockAlignment = 4096;
+
+        struct AlignedDelete
+        {
+            void operator()(char* data) const { ::operator delete[](data, std::align_val_t(BlockAlignment)); }
+        };
+
+        struct Block
+        {
+            std::unique_ptr<char[], AlignedDelete> Data;
+            ReadOperation Read;
+            uint64_t Offset = 0;
+            size_t Size = 0;
+            bool Issued = false;
+        };
+
+        // Blocks are issued and consumed in the same ring order, so offsets line up
+        void issue(Block& block)
+        {
+            if (m_nextOffset >= m_file.Size())
+                return;
+
+            block.Offset = m_nextOffset;
+            block.Size = static_cast<size_t>(std::min<uint64_t>(m_blockSize, m_file.Size() - m_nextOffset));
+            block.Issued = true;
+            m_nextOffset += block.Size;
+            block.Read.Start(m_io, m_file, { block.Data.get(), block.Size }, block.Offset);
+        }
+
+        void split(std::string_view text)
+        {
+            size_t start = 0;
+            m_scanner.ForEach(text.data(), text.size(), [&](size_t end)
+            {
+                if (start == 0 && !m_carry.empty())
+                {
+                    m_joined = std::move(m_carry);
+                    m_joined.append(text.substr(0, end));
+                    m_carry.clear();
+                    m_lines.push_back(m_joined);
+                }
+                else
+                {
+                    m_lines.push_back(text.substr(start, end - start));
+                }
+                start = end + 1;
+            });
+            m_carry.append(text.substr(start));
+        }
+
+        AsyncIo& m_io;
+        const AsyncFile& m_file;
+        const size_t m_blockSize;
+        const size_t m_blockCount;
+        std::unique_ptr<Block[]> m_blocks;
+        uint64_t m_nextOffset = 0;
+        size_t m_next = 0;
+        Block* m_consumed = nullptr;
+        Simd::NewlineScanner m_scanner;
+        std::vector<std::string_view> m_lines;
+        // Start of a line that continues in the next block, and the joined line
+        std::string m_carry;
+        std::string m_joined;
+    };
+
+    struct LineCount
+    {
+        uint64_t Lines = 0;
+        uint64_t Bytes = 0;
+    };
+
+    Coroutines::Task<LineCount> CountLinesAsync(AsyncIo& io, std::string path, size_t blockSize, size_t readAhead)
+    {
+        AsyncFile file(path);
+        AsyncLineReader reader(io, file, blockSize, readAhead);
+        LineCount count;
+        for (auto lines = co_await reader.NextLines(); !lines.empty(); lines = co_await reader.NextLines())
+        {
+            count.Lines += lines.size();
+            for (std::string_view line : lines)
+                count.Bytes += line.size();
+        }
+        co_return count;
+    }
+
+    // Writes log-like files, then reads them all at once through io_uring and through the
+    // thread-pool fallback, against std::getline over the files one after the other. The
+    // page cache is dropped before every run where possible, so the disk is part of it.
+    void BenchmarkAsyncFileRead(uint64_t totalMegabytes = 2048, size_t fileCount = 2,
+                                std::filesystem::path directory = std::filesystem::temp_directory_path())
+    {
+        using Clock = std::chrono::steady_clock;
+
+        std::vector<std::string> paths;
+        const uint64_t bytesPerFile = totalMegabytes * 1024 * 1024 / std::max<size_t>(fileCount, 1);
+        for (size_t f = 0; f < fileCount; ++f)
+        {
+            paths.push_back((directory / ("threads_async_file_" + std::to_string(f) + ".log")).string());
+            std::ofstream out(paths.back(), std::ios::binary);
+            std::string line;
+            uint64_t seed = 0x9e3779b97f4a7c15 + f;
+            for (uint64_t written = 0; written < bytesPerFile; written += line.size())
+            {
+                seed = seed * 6364136223846793005 + 1442695040888963407;
+                line = "2024-05-01T12:00:00.000Z INFO worker-" + std::to_string(seed % 64) + " request id=" + std::to_string(seed >> 20)
+                     + " status=200 latency_us=" + std::to_string((seed >> 8) % 100000) + std::string((seed >> 40) % 80, '.') + '\n';
+                out << line;
+            }
+        }
+
+        auto dropCache = [&paths]
+        {
+#if THREADS_ASYNC_FILE_POSIX && defined(__linux__)
+            for (const std::string& path : paths)
+            {
+                int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd >= 0)
+                {
+                    ::fdatasync(fd);
+                    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                    ::close(fd);
+                }
+            }
+#endif
+        };
+
+        auto report = [&](const char* name, LineCount count, Clock::duration elapsed)
+        {
+            double seconds = std::chrono::duration<double>(elapsed).count();
+            double gigabytes = static_cast<double>(count.Bytes + count.Lines) / (1024.0 * 1024.0 * 1024.0);
+            std::cout << "[AsyncFile] " << name << ": " << count.Lines << " lines, " << gigabytes / seconds << " GiB/s" << std::endl;
+        };
+
+        dropCache();
+        auto start = Clock::now();
+        LineCount getlineCount;
+        for (const std::string& path : paths)
+        {
+            std::ifstream in(path, std::ios::binary);
+            for (std::string line; std::getline(in, line);)
+            {
+                getlineCount.Lines++;
+                getlineCount.Bytes += line.size();
+            }
+        }
+        report("std::getline, one file after the other", getlineCount, Clock::now() - start);
+
+        ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()));
+        for (IoBackend backend : { IoBackend::IoUring, IoBackend::ThreadPool })
+        {
+            AsyncIo io(pool, backend);
+            dropCache();
+            start = Clock::now();
+            std::vector<Coroutines::Task<LineCount>> readers;
+            for (const std::string& path : paths)
+                readers.push_back(CountLinesAsync(io, path, size_t(1) << 20, 4));
+            LineCount total;
+            for (const LineCount& count : Coroutines::SyncWait(Coroutines::WhenAll(std::move(readers))))
+            {
+                total.Lines += count.Lines;
+                total.Bytes += count.Bytes;
+            }
+            auto elapsed = Clock::now() - start;
+
+            if (total.Lines != getlineCount.Lines || total.Bytes != getlineCount.Bytes)
+                std::cout << "[AsyncFile] line count mismatch" << std::endl;
+            if (backend == IoBackend::IoUring && io.Backend() != IoBackend::IoUring)
+                std::cout << "[AsyncFile] io_uring is not available here, using the thread pool" << std::endl;
+            report(io.Backend() == IoBackend::IoUring ? "io_uring, 4 x 1 MiB in flight per file" : "thread pool, 4 x 1 MiB in flight per file",
+                   total, elapsed);
+        }
+
+        for (const std::string& path : paths)
+            std::filesystem::remove(path);
+    }
+}
+
+#endif // THREADS_ASYNC_FILE_HPP_
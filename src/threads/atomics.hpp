@@ -1,9 +1,15 @@
 #pragma once
 
+#include "epoch_reclamation.hpp"
+#include "hardware.hpp"
+
 #include <cassert>
 #include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <optional>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace Threads
@@ -102,40 +108,162 @@ namespace Threads
 /////// Custom Atomic Data //////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+    // Lock-free stack (Treiber stack). Push and TryPop are one CAS on the head each, so
+    // producers and consumers never queue up behind a descheduled lock holder.
+    //
+    // Popped nodes are retired to the epoch domain instead of being deleted: a thread that
+    // is still looking at one can't read freed memory, and an address can't come back
+    // while somebody pinned holds it, which rules out ABA on the head CAS.
     template <typename T>
-    struct Node
-    {
-        std::atomic<Node*> next;
-        std::atomic<Node*> prev;
-        T data;
-
-        // ...
-    };
-
-    template <typename T>  
     class AtomicList
     {
     public:
-        void push(T value)
+        AtomicList() = default;
+
+        AtomicList(const AtomicList&) = delete;
+        AtomicList& operator=(const AtomicList&) = delete;
+
+        // Not safe against concurrent use, like any destructor
+        ~AtomicList()
         {
-            Node<T>* newNode = new Node<T>(value); 
-            Node<T>* prevHead = head.load();
+            Node* node = m_head.load(std::memory_order_relaxed);
+            while (node)
+                delete std::exchange(node, node->Next);
+        }
 
-            while(!head.compare_exchange_weak(prevHead, newNode))
+        void Push(T value)
+        {
+            Node* newNode = new Node { std::move(value), m_head.load(std::memory_order_relaxed) };
+
+            // The node is complete before the CAS publishes it; on failure
+            // the CAS reloads the head straight into newNode->Next
+            while (!m_head.compare_exchange_weak(newNode->Next, newNode,
+                                                 std::memory_order_release, std::memory_order_relaxed))
             {
-            // retry  
+                // retry
             }
+        }
 
-            newNode->next = prevHead;  
-            prevHead->prev = newNode; 
+        // Takes the most recently pushed value. Returns a copy because a concurrent
+        // ForEach() may still be reading the node's value until the node is reclaimed.
+        std::optional<T> TryPop()
+        {
+            auto guard = m_domain.Pin();
+
+            Node* head = m_head.load(std::memory_order_acquire);
+            while (head && !m_head.compare_exchange_weak(head, head->Next,
+                                                         std::memory_order_acquire, std::memory_order_acquire))
+            {
+                // retry with the head the CAS found
+            }
+
+            if (!head)
+                return std::nullopt;
+
+            std::optional<T> value(head->Value);
+            m_domain.Retire(head);
+            return value;
         }
 
-    // ...
+        // Calls func(value) for every value, newest first. Sees a consistent chain of
+        // nodes but not a snapshot: values pushed or popped meanwhile may or may not show.
+        template <typename F>
+        void ForEach(F&& func) const
+        {
+            auto guard = m_domain.Pin();
+            for (Node* node = m_head.load(std::memory_order_acquire); node; node = node->Next)
+                func(static_cast<const T&>(node->Value));
+        }
+
+        bool Empty() const { return m_head.load(std::memory_order_acquire) == nullptr; }
 
     private:
-        std::atomic<Node<T>*> head;
+        struct Node
+        {
+            T Value;
+            // Set before the node is published and never changed afterwards
+            Node* Next;
+        };
+
+        alignas(CacheLineSize) std::atomic<Node*> m_head = nullptr;
+        EpochDomain& m_domain = EpochDomain::Global();
     };
 
+    // Producers push, consumers pop and a reader keeps walking the list, all at once.
+    // Every value must come out exactly once. Build with CPP_EXAMPLES_TSAN=ON to have
+    // ThreadSanitizer check the reclamation as well.
+    void TestAtomicListStress(size_t producers = 4, size_t consumers = 4, size_t perProducer = 100'000)
+    {
+        AtomicList<uint64_t> list;
+        std::atomic<size_t> producersDone = 0;
+        std::atomic<size_t> popped = 0;
+        std::atomic<uint64_t> poppedSum = 0;
+        std::vector<std::atomic<uint8_t>> seen(producers * perProducer);
+
+        std::vector<std::thread> threads;
+        for (size_t p = 0; p < producers; ++p)
+        {
+            threads.emplace_back([&, p]
+            {
+                for (size_t i = 0; i < perProducer; ++i)
+                    list.Push(p * perProducer + i);
+                producersDone.fetch_add(1);
+            });
+        }
+
+        for (size_t c = 0; c < consumers; ++c)
+        {
+            threads.emplace_back([&]
+            {
+                while (true)
+                {
+                    if (std::optional<uint64_t> value = list.TryPop())
+                    {
+                        seen[*value].fetch_add(1, std::memory_order_relaxed);
+                        poppedSum.fetch_add(*value, std::memory_order_relaxed);
+                        popped.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    else if (producersDone.load() == producers && list.Empty())
+                    {
+                        break;
+                    }
+                }
+            });
+        }
+
+        // Traversals overlap with pops, which is what reclamation has to survive
+        std::atomic<bool> stopReader = false;
+        uint64_t traversals = 0;
+        std::thread reader([&]
+        {
+            while (!stopReader.load())
+            {
+                uint64_t sum = 0;
+                list.ForEach([&sum](uint64_t value) { sum += value; });
+                ++traversals;
+            }
+        });
+
+        for (auto& thread : threads)
+            thread.join();
+        stopReader.store(true);
+        reader.join();
+
+        const size_t total = producers * perProducer;
+        size_t duplicates = 0;
+        for (auto& count : seen)
+            duplicates += count.load() != 1 ? 1 : 0;
+
+        assert(popped.load() == total);
+        assert(poppedSum.load() == total * (total - 1) / 2);
+        assert(duplicates == 0);
+
+        EpochDomain::Global().Collect();
+        std::cout << "[AtomicList] " << popped << " of " << total << " values popped once each, "
+                  << traversals << " concurrent traversals, " << EpochDomain::Global().FreedCount()
+                  << " of " << EpochDomain::Global().RetiredCount() << " retired nodes freed so far" << std::endl;
+    }
+
     void TestAtomic()
     {
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
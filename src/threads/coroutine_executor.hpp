@@ -0,0 +1,504 @@
+#pragma once
+#ifndef THREADS_COROUTINE_EXECUTOR_HPP_
+#define THREADS_COROUTINE_EXECUTOR_HPP_
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Coroutines that run on a ThreadPool instead of a thread each: a suspended coroutine
+// is just a heap frame, and resuming it is one task on the pool.
+namespace Threads::Coroutines
+{
+    template <typename T = void>
+    class Task;
+
+    // Shared by all Task promises: lazy start, and on completion a hand-off to whoever
+    // awaited the task. The awaiter resumes the task with a plain resume() and then races
+    // the task's final_suspend() for the flag: if the task got there first it completed
+    // inline, and the awaiter just carries on from await_suspend() instead of being resumed
+    // from inside the task's frame. A loop awaiting a million tasks that complete
+    // synchronously therefore runs in constant stack space at any optimization level,
+    // without relying on the compiler to turn a symmetric transfer into a tail call.
+    class TaskPromiseBase
+    {
+    public:
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            // Only the side that loses the race resumes the continuation
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                TaskPromiseBase& promise = handle.promise();
+                if (promise.m_ready.exchange(true, std::memory_order_acq_rel))
+                    return promise.m_continuation;
+                return std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept { }
+        };
+
+        std::suspend_always initial_suspend() noexcept { return { }; }
+        FinalAwaiter final_suspend() noexcept { return { }; }
+
+        void unhandled_exception() noexcept { m_exception = std::current_exception(); }
+
+        // False if the task already finished, the caller then continues without suspending
+        bool TrySetContinuation(std::coroutine_handle<> continuation) noexcept
+        {
+            m_continuation = continuation;
+            return !m_ready.exchange(true, std::memory_order_acq_rel);
+        }
+
+    protected:
+        void rethrowIfFailed()
+        {
+            if (m_exception)
+                std::rethrow_exception(m_exception);
+        }
+
+    private:
+        // Nobody awaiting: finishing just suspends the coroutine for good
+        std::coroutine_handle<> m_continuation = std::noop_coroutine();
+        std::atomic<bool> m_ready = false;
+        std::exception_ptr m_exception;
+    };
+
+    template <typename T>
+    class TaskPromise : public TaskPromiseBase
+    {
+    public:
+        Task<T> get_return_object() noexcept;
+
+        template <typename U>
+            requires std::is_convertible_v<U&&, T>
+        void return_value(U&& value) { m_value.emplace(std::forward<U>(value)); }
+
+        T TakeResult()
+        {
+            rethrowIfFailed();
+            return std::move(*m_value);
+        }
+
+    private:
+        std::optional<T> m_value;
+    };
+
+    template <>
+    class TaskPromise<void> : public TaskPromiseBase
+    {
+    public:
+        Task<void> get_return_object() noexcept;
+
+        void return_void() noexcept { }
+        void TakeResult() { rethrowIfFailed(); }
+    };
+
+    // Lazily started coroutine that produces a T. Nothing runs until the task is awaited;
+    // the awaiting coroutine is then suspended, the task runs in its place, and the awaiter
+    // resumes on whatever thread the task finished on. Exceptions travel to the awaiter.
+    template <typename T>
+    class [[nodiscard]] Task
+    {
+    public:
+        using promise_type = TaskPromise<T>;
+
+        Task() = default;
+        explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) { }
+
+        Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, { })) { }
+        Task& operator=(Task&& other) noexcept
+        {
+            if (this != &other)
+            {
+                if (m_handle)
+                    m_handle.destroy();
+                m_handle = std::exchange(other.m_handle, { });
+            }
+            return *this;
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        ~Task() { if (m_handle) m_handle.destroy(); }
+
+        bool Done() const { return !m_handle || m_handle.done(); }
+
+        auto operator co_await() const noexcept
+        {
+            struct Awaiter
+            {
+                std::coroutine_handle<promise_type> Handle;
+
+                bool await_ready() const noexcept { return !Handle || Handle.done(); }
+
+                // Runs the task until it first suspends; a task that completed in the
+                // meantime returns here instead of resuming us from its own frame
+                bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+                {
+                    Handle.resume();
+                    return Handle.promise().TrySetContinuation(awaiting);
+                }
+
+                T await_resume() { return Handle.promise().TakeResult(); }
+            };
+            return Awaiter { m_handle };
+        }
+
+    private:
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    template <typename T>
+    Task<T> TaskPromise<T>::get_return_object() noexcept
+    {
+        return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+    }
+
+    inline Task<void> TaskPromise<void>::get_return_object() noexcept
+    {
+        return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+    }
+
+    // co_await ScheduleOn(pool) moves the rest of the coroutine onto a pool worker
+    class ScheduleOnAwaiter
+    {
+    public:
+        ScheduleOnAwaiter(ThreadPool& pool, TaskPriority priority) : m_pool(pool), m_priority(priority) { }
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { m_pool.Enqueue(m_priority, [handle] { handle.resume(); }); }
+        void await_resume() const noexcept { }
+
+    private:
+        ThreadPool& m_pool;
+        TaskPriority m_priority;
+    };
+
+    inline ScheduleOnAwaiter ScheduleOn(ThreadPool& pool, TaskPriority priority = TaskPriority::Normal)
+    {
+        return ScheduleOnAwaiter(pool, priority);
+    }
+
+    // Where coroutines continue when nobody names a pool, one worker per hardware thread
+    inline ThreadPool& DefaultPool()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    inline ScheduleOnAwaiter ScheduleOn(TaskPriority priority = TaskPriority::Normal)
+    {
+        return ScheduleOnAwaiter(DefaultPool(), priority);
+    }
+
+    // Children of WhenAll() count down; the last one to finish resumes the parent. The
+    // parent holds one extra count until it has suspended, so a child finishing early
+    // can't resume a parent that isn't suspended yet.
+    class WhenAllLatch
+    {
+    public:
+        explicit WhenAllLatch(size_t count) : m_count(count + 1) { }
+
+        std::coroutine_handle<> Arrive() noexcept
+        {
+            return m_count.fetch_sub(1, std::memory_order_acq_rel) == 1 ? m_parent : std::noop_coroutine();
+        }
+
+        bool await_ready() const noexcept { return m_count.load(std::memory_order_acquire) == 1; }
+
+        bool await_suspend(std::coroutine_handle<> parent) noexcept
+        {
+            m_parent = parent;
+            return m_count.fetch_sub(1, std::memory_order_acq_rel) > 1;
+        }
+
+        void await_resume() const noexcept { }
+
+    private:
+        std::atomic<size_t> m_count;
+        std::coroutine_handle<> m_parent;
+    };
+
+    // Minimal coroutine that awaits one task for WhenAll() and reports to the latch
+    class WhenAllChild
+    {
+    public:
+        struct promise_type
+        {
+            WhenAllLatch* Latch = nullptr;
+
+            struct FinalAwaiter
+            {
+                bool await_ready() const noexcept { return false; }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    return handle.promise().Latch->Arrive();
+                }
+
+                void await_resume() const noexcept { }
+            };
+
+            WhenAllChild get_return_object() noexcept { return WhenAllChild(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return { }; }
+            FinalAwaiter final_suspend() noexcept { return { }; }
+            void return_void() noexcept { }
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+
+        explicit WhenAllChild(std::coroutine_handle<promise_type> handle) : m_handle(handle) { }
+        WhenAllChild(WhenAllChild&& other) noexcept : m_handle(std::exchange(other.m_handle, { })) { }
+        WhenAllChild(const WhenAllChild&) = delete;
+        WhenAllChild& operator=(const WhenAllChild&) = delete;
+        WhenAllChild& operator=(WhenAllChild&&) = delete;
+        ~WhenAllChild() { if (m_handle) m_handle.destroy(); }
+
+        // Runs the child until it first suspends
+        void Start(WhenAllLatch& latch)
+        {
+            m_handle.promise().Latch = &latch;
+            m_handle.resume();
+        }
+
+    private:
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    template <typename T>
+    using WhenAllSlot = std::conditional_t<std::is_void_v<T>, std::monostate, std::optional<T>>;
+
+    template <typename T>
+    WhenAllChild RunWhenAllChild(Task<T> task, WhenAllSlot<T>& slot, std::exception_ptr& error)
+    {
+        try
+        {
+            if constexpr (std::is_void_v<T>)
+                co_await task;
+            else
+                slot.emplace(co_await task);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+    }
+
+    // Starts all tasks at once and completes when the last one has. Each task runs on the
+    // calling thread until it first suspends (typically at a ScheduleOn()), so they fan out
+    // without an extra hop. The first exception, in task order, is rethrown.
+    template <typename T>
+    Task<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> WhenAll(std::vector<Task<T>> tasks)
+    {
+        std::vector<WhenAllSlot<T>> slots(tasks.size());
+        std::vector<std::exception_ptr> errors(tasks.size());
+        WhenAllLatch latch(tasks.size());
+
+        std::vector<WhenAllChild> children;
+        children.reserve(tasks.size());
+        for (size_t i = 0; i < tasks.size(); ++i)
+            children.push_back(RunWhenAllChild(std::move(tasks[i]), slots[i], errors[i]));
+        for (WhenAllChild& child : children)
+            child.Start(latch);
+
+        co_await latch;
+
+        for (std::exception_ptr& error : errors)
+        {
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        if constexpr (!std::is_void_v<T>)
+        {
+            std::vector<T> values;
+            values.reserve(slots.size());
+            for (auto& slot : slots)
+                values.push_back(std::move(*slot));
+            co_return values;
+        }
+    }
+
+    // Signalled by the SyncWait() coroutine on completion. The flag is set and notified under
+    // the mutex, so the waiter can't return and free the state while Finish() still uses it.
+    class SyncWaitState
+    {
+    public:
+        void Finish()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done = true;
+            m_finished.notify_one();
+        }
+
+        void Wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_finished.wait(lock, [this] { return m_done; });
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_finished;
+        bool m_done = false;
+    };
+
+    class SyncWaitTask
+    {
+    public:
+        struct promise_type
+        {
+            SyncWaitState* State = nullptr;
+
+            struct FinalAwaiter
+            {
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<promise_type> handle) noexcept { handle.promise().State->Finish(); }
+                void await_resume() const noexcept { }
+            };
+
+            SyncWaitTask get_return_object() noexcept { return SyncWaitTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return { }; }
+            FinalAwaiter final_suspend() noexcept { return { }; }
+            void return_void() noexcept { }
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+
+        explicit SyncWaitTask(std::coroutine_handle<promise_type> handle) : m_handle(handle) { }
+        SyncWaitTask(const SyncWaitTask&) = delete;
+        SyncWaitTask& operator=(const SyncWaitTask&) = delete;
+        ~SyncWaitTask() { if (m_handle) m_handle.destroy(); }
+
+        void Run(SyncWaitState& state)
+        {
+            m_handle.promise().State = &state;
+            m_handle.resume();
+            state.Wait();
+        }
+
+    private:
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    template <typename T>
+    SyncWaitTask RunSyncWait(Task<T>& task, WhenAllSlot<T>& slot, std::exception_ptr& error)
+    {
+        try
+        {
+            if constexpr (std::is_void_v<T>)
+                co_await task;
+            else
+                slot.emplace(co_await task);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+    }
+
+    // Bridge from ordinary code: runs the task and blocks the calling thread until it is
+    // done. Don't call it on a pool worker the task needs, that worker would just wait.
+    template <typename T>
+    T SyncWait(Task<T> task)
+    {
+        WhenAllSlot<T> slot;
+        std::exception_ptr error;
+        SyncWaitState state;
+        RunSyncWait(task, slot, error).Run(state);
+
+        if (error)
+            std::rethrow_exception(error);
+        if constexpr (!std::is_void_v<T>)
+            return std::move(*slot);
+    }
+
+    Task<int64_t> HopAndCompute(ThreadPool& pool, int64_t value, int hops)
+    {
+        for (int hop = 0; hop < hops; ++hop)
+        {
+            co_await ScheduleOn(pool);
+            value = value * 3 + 1;
+        }
+        co_return value;
+    }
+
+    Task<int64_t> Immediate(int64_t value)
+    {
+        co_return value;
+    }
+
+    Task<int64_t> SumImmediates(int64_t count)
+    {
+        int64_t sum = 0;
+        for (int64_t i = 0; i < count; ++i)
+            sum += co_await Immediate(i);
+        co_return sum;
+    }
+
+    Task<size_t> CountWorkerThreads(ThreadPool& pool, size_t samples)
+    {
+        // One hop at a time, so the set needs no lock
+        std::unordered_set<std::thread::id> seen;
+        for (size_t i = 0; i < samples; ++i)
+        {
+            co_await ScheduleOn(pool);
+            seen.insert(std::this_thread::get_id());
+        }
+        co_return seen.size();
+    }
+
+    // 100k coroutines hop across a fixed-size pool three times each, then a single
+    // coroutine awaits a million synchronously completing tasks, which would overflow the
+    // stack if each completion resumed the awaiter from inside the finished task
+    void TestCoroutineExecutor(size_t coroutines = 100'000, int hops = 3)
+    {
+        ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()));
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Task<int64_t>> tasks;
+        tasks.reserve(coroutines);
+        for (size_t i = 0; i < coroutines; ++i)
+            tasks.push_back(HopAndCompute(pool, static_cast<int64_t>(i), hops));
+
+        std::vector<int64_t> results = SyncWait(WhenAll(std::move(tasks)));
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            int64_t expected = static_cast<int64_t>(i);
+            for (int hop = 0; hop < hops; ++hop)
+                expected = expected * 3 + 1;
+            assert(results[i] == expected);
+        }
+
+        std::cout << "[Coroutines] " << coroutines << " coroutines x " << hops << " hops on " << pool.ThreadCount()
+                  << " threads in " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms, "
+                  << SyncWait(CountWorkerThreads(pool, 1000)) << " distinct worker threads seen" << std::endl;
+
+        const int64_t count = 1'000'000;
+        int64_t sum = SyncWait(SumImmediates(count));
+        assert(sum == count * (count - 1) / 2);
+        std::cout << "[Coroutines] awaited " << count << " synchronously completing tasks in one loop, sum " << sum << std::endl;
+    }
+}
+
+#endif // THREADS_COROUTINE_EXECUTOR_HPP_
@@ -4,12 +4,21 @@
 
 // https://medium.com/@AlexanderObregon/understanding-c-coroutine-implementation-8e6e5a2c3edd
 
+#include "async_file.hpp"
+#include "generator.hpp"
+#include "timer_wheel.hpp"
+
 #include <coroutine>
-#include <fstream>
 #include <iostream>
+#include <mutex>
 #include <optional>
 #include <queue>
+#include <string>
+#include <string_view>
+#include <system_error>
 #include <thread>
+#include <utility>
+#include <vector>
 
 namespace Threads
 {
@@ -55,146 +64,84 @@ namespace Threads
     }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-////////// Asynchronous I/O Operations //////////////////////////////////////////////////////////////////////////
+////////// Lazy Sequences ///////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    struct FileReader
+    // Each value is computed when the loop asks for it; no promise type to write
+    Coroutines::Generator<int64_t> Fibonacci(int count)
     {
-        struct promise_type
+        int64_t a = 0;
+        int64_t b = 1;
+        for (int i = 0; i < count; ++i)
         {
-            FileReader get_return_object()
-            {
-                return FileReader { std::coroutine_handle<promise_type>::from_promise(*this) };
-            }
-            
-            std::suspend_always initial_suspend() noexcept { return { }; }
-            std::suspend_always final_suspend() noexcept { return { }; }
-            
-            void return_void() { }
-            void unhandled_exception() { std::terminate(); }
-        };
-        
-        std::coroutine_handle<promise_type> Handle;
-        
-        explicit FileReader(std::coroutine_handle<promise_type> handle) : Handle(handle) { }
-        
-        FileReader(FileReader&& other) noexcept : Handle(other.Handle) { other.Handle = { }; }
-        FileReader(const FileReader& other) = delete;
-        
-        ~FileReader() { if (Handle) Handle.destroy(); }
+            co_yield a;
+            a = std::exchange(b, a + b);
+        }
+    }
 
-    };
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////// Asynchronous I/O Operations //////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    struct FileReaderAwaiter
+    // Reads one file in large blocks, several in flight. While it waits for a read the
+    // coroutine holds no thread, so the pool runs the other file's reader meanwhile.
+    Coroutines::Task<void> ProcessFile(AsyncIo& io, std::string filename)
     {
-        std::ifstream file;
-        std::string line;
-        bool finished = false;
-
-        bool await_ready() const { return finished; }
-
-        void await_suspend(std::coroutine_handle<> handle)
+        std::optional<AsyncFile> file;
+        try
         {
-            if (std::getline(file, line))   
-                std::cout << "Processing: " << line << '\n';
-            else
-                finished = true;
-            
-            handle.resume();
+            file.emplace(filename);
+        }
+        catch (const std::system_error& error)
+        {
+            std::cout << error.what() << '\n';
+            co_return;
         }
 
-        void await_resume() { }
-    };
-
-    FileReaderAwaiter ReadAsync(const std::string& filename)
-    {
-        FileReaderAwaiter awaiter;
-        awaiter.file.open(filename);
-        return awaiter;
+        AsyncLineReader reader(io, *file);
+        for (auto lines = co_await reader.NextLines(); !lines.empty(); lines = co_await reader.NextLines())
+        {
+            for (std::string_view line : lines)
+                std::cout << "Processing " + filename + ": " + std::string(line) + '\n';
+        }
     }
 
-    FileReader ProcessFiles()
+    Coroutines::Task<void> ProcessFiles(AsyncIo& io)
     {
-        FileReaderAwaiter r1 = ReadAsync("file1.txt");
-        FileReaderAwaiter r2 = ReadAsync("file2.txt");
-
-        while (!r1.finished || !r2.finished)
-        {
-            co_await r1;
-            co_await r2;
-        }
-        co_return;
+        std::vector<Coroutines::Task<void>> files;
+        files.push_back(ProcessFile(io, "file1.txt"));
+        files.push_back(ProcessFile(io, "file2.txt"));
+        co_await Coroutines::WhenAll(std::move(files));
     }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////// Concurrency and Task Coordination ////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    struct Task
+    struct Simulation
     {
-        struct promise_type
-        {
-            Task get_return_object()
-            {
-                return Task { std::coroutine_handle<promise_type>::from_promise(*this) };
-            }
-
-            std::suspend_always initial_suspend() noexcept { return { }; }   // create suspended
-            std::suspend_always final_suspend() noexcept { return { }; }     // keep frame alive
-            
-            void return_void() { }
-            void unhandled_exception() { std::terminate(); }
-        };
-
-        std::coroutine_handle<promise_type> Handle;
-
-        explicit Task(std::coroutine_handle<promise_type> handle) : Handle(handle) { }
-        
-        Task(Task&& other) noexcept : Handle(other.Handle) { other.Handle = { }; }
-        Task(const Task& other) = delete;
-        
-        ~Task() { if (Handle) Handle.destroy(); }
-
-        void start() { if (Handle && !Handle.done()) Handle.resume(); }
-
-        struct TaskAwaiter
-        {
-            std::chrono::milliseconds Delay;
-            bool await_ready() const { return false; }
-            
-            void await_suspend(std::coroutine_handle<> handle) const
-            {
-                auto delay = Delay;  // copy to extend lifetime
-                std::thread([handle, delay]()
-                {
-                    std::this_thread::sleep_for(delay);
-                    handle.resume();
-                }).detach();
-            }
-            
-            void await_resume() const { }
-        };
-
-        static TaskAwaiter MoveEntity(int id, int distance)
+        // The delays sleep on the timer wheel: no thread is held while an entity waits,
+        // and the coroutine continues on the default pool once the time is up
+        static SleepAwaiter MoveEntity(int id, int distance)
         {
             std::cout << "Entity " << id << " Moving " << distance << " units\n";
-            return TaskAwaiter { std::chrono::milliseconds(500 * distance) };
+            return SleepFor(std::chrono::milliseconds(500 * distance));
         }
 
-        static TaskAwaiter UpdateEntity(int id)
+        static SleepAwaiter UpdateEntity(int id)
         {
             std::cout << "Entity " << id << " Updating\n";
-            return TaskAwaiter { std::chrono::milliseconds(100) };
+            return SleepFor(std::chrono::milliseconds(100));
         }
     };
 
-    Task RunSimulation()
+    Coroutines::Task<void> RunSimulation()
     {
-        co_await Task::MoveEntity(1, 5);
-        co_await Task::UpdateEntity(1);
-        co_await Task::MoveEntity(2, 3);
-        co_await Task::UpdateEntity(2);
-        co_await Task::MoveEntity(1, 2);
+        co_await Simulation::MoveEntity(1, 5);
+        co_await Simulation::UpdateEntity(1);
+        co_await Simulation::MoveEntity(2, 3);
+        co_await Simulation::UpdateEntity(2);
+        co_await Simulation::MoveEntity(1, 2);
     }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -207,52 +154,77 @@ namespace Threads
         std::string Data;
     };
 
+    struct WaitForEvent;
+
+    // Hands events to one waiting handler. push() gives an event straight to a suspended
+    // waiter and resumes it as a task on the pool; no thread waits or polls in between.
     struct EventQueue
     {
-        std::queue<Event> Events;
+        explicit EventQueue(ThreadPool& pool) : Pool(pool) { }
+
+        void push(Event event);
 
-        void push(const Event& event) { Events.push(event); }
-        
         std::optional<Event> try_pop()
         {
+            std::lock_guard<std::mutex> lock(Mutex);
             if (Events.empty())
                 return std::nullopt;
-            
-            Event event = Events.front();
+
+            Event event = std::move(Events.front());
             Events.pop();
             return event;
         }
+
+        ThreadPool& Pool;
+        std::mutex Mutex;
+        std::queue<Event> Events;
+        WaitForEvent* Waiter = nullptr;
     };
 
-    // Awaitable that resumes the awaiting coroutine once an event is available.
-    // It polls on a small background worker to keep the example self-contained.
+    // Awaitable that resumes the awaiting coroutine once an event is available
     struct WaitForEvent
     {
-        EventQueue& EventQueue;
+        EventQueue& Queue;
         Event Out{ -1, "" };
+        std::coroutine_handle<> Handle { };
 
         bool await_ready() const { return false; }
 
-        void await_suspend(std::coroutine_handle<> handle)
+        // Takes a queued event without suspending, or parks in the queue for push()
+        bool await_suspend(std::coroutine_handle<> handle)
         {
-            std::thread([this, handle]() mutable
+            std::lock_guard<std::mutex> lock(Queue.Mutex);
+            if (!Queue.Events.empty())
             {
-                for (;;)
-                {
-                    if (auto event = EventQueue.try_pop())
-                    {
-                        Out = *event;
-                        handle.resume();
-                        break;
-                    }
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                }
-            }).detach();
+                Out = std::move(Queue.Events.front());
+                Queue.Events.pop();
+                return false;
+            }
+
+            Handle = handle;
+            Queue.Waiter = this;
+            return true;
         }
 
-        Event await_resume() const { return Out; }
+        Event await_resume() { return std::move(Out); }
     };
 
+    inline void EventQueue::push(Event event)
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        if (!Waiter)
+        {
+            Events.push(std::move(event));
+            return;
+        }
+
+        WaitForEvent* waiter = std::exchange(Waiter, nullptr);
+        lock.unlock();
+
+        waiter->Out = std::move(event);
+        Pool.Enqueue([handle = waiter->Handle] { handle.resume(); });
+    }
+
     struct EventHandler
     {
         struct promise_type
@@ -287,7 +259,10 @@ namespace Threads
     {
         while (true)
         {
-            Event e = co_await WaitForEvent{ queue };
+            // A named awaiter: GCC 12 frees a temporary awaiter's members twice when its
+            // result initializes a variable, here the event's string
+            WaitForEvent wait{ queue };
+            Event e = co_await wait;
             std::cout << "Handling event " << e.Id << ": " << e.Data << std::endl;
         }
     }
@@ -345,10 +320,13 @@ namespace Threads
 
     ConnectionFlow ManageConnection()
     {
-        co_await StateStep{ "Connecting" };
-        co_await StateStep{ "Connected" };
-        co_await StateStep{ "Disconnecting" };
-        co_await StateStep{ "Disconnected" };
+        // Named for the same GCC 12 bug as in HandleEvents(): a temporary awaiter's
+        // string gets freed twice
+        for (const char* state : { "Connecting", "Connected", "Disconnecting", "Disconnected" })
+        {
+            StateStep step{ state };
+            co_await step;
+        }
     }
 
     void TestCoroutines()
@@ -356,14 +334,18 @@ namespace Threads
         ReturnValue result = ComputeValue();
         std::cout << "Computed Value: " << result.Get() << std::endl;
 
-        FileReader fileReader = ProcessFiles();
-        fileReader.Handle.resume(); // start and run to completion
+        std::cout << "Fibonacci:";
+        for (int64_t value : Fibonacci(10))
+            std::cout << ' ' << value;
+        std::cout << std::endl;
+
+        ThreadPool pool(2);
+        AsyncIo io(pool);   // io_uring where available, else reads on the pool
+        Coroutines::SyncWait(ProcessFiles(io));
 
-        Task task = RunSimulation();   // created suspended
-        task.start();                  // kick it off
-        std::this_thread::sleep_for(std::chrono::seconds(5));
+        Coroutines::SyncWait(RunSimulation());
 
-        EventQueue queue;
+        EventQueue queue(pool);
 
         // Produce a few events in the background.
         std::thread producer([&]()
@@ -374,12 +356,12 @@ namespace Threads
                 std::this_thread::sleep_for(std::chrono::milliseconds(300));
             }
         });
-        producer.detach();
 
         EventHandler handler = HandleEvents(queue);  // created suspended
         handler.start();
 
-        std::this_thread::sleep_for(std::chrono::seconds(3)); // let it run a bit
+        producer.join();
+        pool.WaitIdle(); // the last event has been handled
 
         ConnectionFlow flow = ManageConnection(); // created suspended
         flow.start();
@@ -0,0 +1,185 @@
+#pragma once
+#ifndef THREADS_CPU_TOPOLOGY_HPP_
+#define THREADS_CPU_TOPOLOGY_HPP_
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+namespace Threads
+{
+    struct NumaNode
+    {
+        size_t Id = 0;
+        // Logical CPUs of this node that the process is allowed to run on
+        std::vector<size_t> Cpus;
+    };
+
+    // Parses the kernel's cpulist format, e.g. "0-3,8-11,16"
+    inline std::vector<size_t> ParseCpuList(const std::string& text)
+    {
+        std::vector<size_t> cpus;
+        std::stringstream stream(text);
+        std::string range;
+        while (std::getline(stream, range, ','))
+        {
+            range.erase(std::remove_if(range.begin(), range.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)); }), range.end());
+            if (range.empty())
+                continue;
+
+            size_t dash = range.find('-');
+            size_t first = std::stoul(range.substr(0, dash));
+            size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+            for (size_t cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    // CPUs in the affinity mask of the calling thread. Respects taskset and cgroup
+    // cpusets, so a pool started inside a container doesn't pin to foreign CPUs.
+    inline std::vector<size_t> AllowedCpus()
+    {
+        std::vector<size_t> cpus;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+            for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &set))
+                    cpus.push_back(cpu);
+            }
+        }
+#endif
+        if (cpus.empty())
+        {
+            for (size_t cpu = 0; cpu < std::max<size_t>(std::thread::hardware_concurrency(), 1); ++cpu)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    // The NUMA nodes from /sys/devices/system/node, sorted by id, with only the CPUs we
+    // may use. Where there is no such directory (not Linux, or a kernel without NUMA)
+    // every allowed CPU is reported as part of a single node 0.
+    inline std::vector<NumaNode> NumaTopology()
+    {
+        const std::vector<size_t> allowed = AllowedCpus();
+        std::vector<NumaNode> nodes;
+
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error))
+        {
+            const std::string name = entry.path().filename().string();
+            if (name.rfind("node", 0) != 0 || name.size() == 4
+                || !std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+                continue;
+
+            std::ifstream file(entry.path() / "cpulist");
+            std::string list;
+            if (!std::getline(file, list))
+                continue;
+
+            NumaNode node;
+            node.Id = std::stoul(name.substr(4));
+            for (size_t cpu : ParseCpuList(list))
+            {
+                if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                    node.Cpus.push_back(cpu);
+            }
+
+            // Memory-only nodes and nodes outside our cpuset have nothing to run on
+            if (!node.Cpus.empty())
+                nodes.push_back(std::move(node));
+        }
+
+        if (nodes.empty())
+            nodes.push_back(NumaNode { 0, allowed });
+
+        std::sort(nodes.begin(), nodes.end(), [](const NumaNode& lhs, const NumaNode& rhs) { return lhs.Id < rhs.Id; });
+        return nodes;
+    }
+
+    // Fills one node before moving on to the next: workers share caches and memory
+    inline std::vector<size_t> CompactCpuOrder(const std::vector<NumaNode>& nodes)
+    {
+        std::vector<size_t> order;
+        for (const NumaNode& node : nodes)
+            order.insert(order.end(), node.Cpus.begin(), node.Cpus.end());
+        return order;
+    }
+
+    // Deals CPUs round-robin over the nodes: a small pool gets the memory bandwidth
+    // and last-level cache of every socket instead of crowding the first one
+    inline std::vector<size_t> ScatterCpuOrder(const std::vector<NumaNode>& nodes)
+    {
+        size_t total = 0;
+        for (const NumaNode& node : nodes)
+            total += node.Cpus.size();
+
+        std::vector<size_t> order;
+        for (size_t i = 0; order.size() < total; ++i)
+        {
+            for (const NumaNode& node : nodes)
+            {
+                if (i < node.Cpus.size())
+                    order.push_back(node.Cpus[i]);
+            }
+        }
+        return order;
+    }
+
+    // Logical CPU the calling thread runs on right now, or -1 where it can't be asked
+    inline int CurrentCpu()
+    {
+#if defined(__linux__)
+        return sched_getcpu();
+#else
+        return -1;
+#endif
+    }
+
+    // Restricts the calling thread to one CPU. Returns false where pinning isn't
+    // supported or the CPU is not available, the thread then keeps running unpinned.
+    inline bool PinCurrentThread(size_t cpu)
+    {
+#if defined(__linux__)
+        if (cpu >= CPU_SETSIZE)
+            return false;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
+    // Names the calling thread as shown by top, perf and debuggers. Linux allows
+    // 15 characters plus the terminator, longer names are cut.
+    inline void NameCurrentThread(const std::string& name)
+    {
+#if defined(__linux__)
+        pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#else
+        (void)name;
+#endif
+    }
+}
+
+#endif // THREADS_CPU_TOPOLOGY_HPP_
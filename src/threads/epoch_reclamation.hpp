@@ -0,0 +1,296 @@
+#pragma once
+#ifndef THREADS_EPOCH_RECLAMATION_HPP_
+#define THREADS_EPOCH_RECLAMATION_HPP_
+
+#include "hardware.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Threads
+{
+    // Epoch-based reclamation for lock-free data structures. A node that was unlinked may
+    // still be read by threads that loaded a pointer to it before; it is only freed once
+    // every thread that could have done so has moved on.
+    //
+    // Readers Pin() the domain for as long as they hold pointers into the structure. The
+    // global epoch only advances when every pinned thread has seen the current one, so a
+    // node retired in epoch e is unreachable for everybody once the epoch reached e + 2.
+    // Pinning is one store, there is no per-node counter or hazard slot to publish.
+    class EpochDomain
+    {
+    public:
+        // Keeps the calling thread pinned until it goes out of scope. Guards may nest.
+        class Guard
+        {
+        public:
+            explicit Guard(EpochDomain& domain) : m_domain(&domain) { m_domain->enter(); }
+            ~Guard() { if (m_domain) m_domain->leave(); }
+
+            Guard(Guard&& other) noexcept : m_domain(std::exchange(other.m_domain, nullptr)) { }
+            Guard(const Guard&) = delete;
+            Guard& operator=(const Guard&) = delete;
+            Guard& operator=(Guard&&) = delete;
+
+        private:
+            EpochDomain* m_domain;
+        };
+
+        // The process-wide domain. Threads register with it on first use and hand
+        // their record back when they exit, so short-lived threads don't leak records.
+        static EpochDomain& Global()
+        {
+            static EpochDomain domain;
+            return domain;
+        }
+
+        EpochDomain(const EpochDomain&) = delete;
+        EpochDomain& operator=(const EpochDomain&) = delete;
+
+        ~EpochDomain()
+        {
+            // Nobody can be pinned any more, everything left is garbage
+            ThreadRecord* record = m_records.load();
+            while (record)
+            {
+                for (auto& bag : record->Bags)
+                    freeAll(bag.Items);
+                ThreadRecord* next = record->Next;
+                delete record;
+                record = next;
+            }
+            freeAll(m_orphans);
+        }
+
+        [[nodiscard]] Guard Pin() { return Guard(*this); }
+
+        // Hands an unlinked object over, it is deleted once no pinned thread can see it
+        template <typename T>
+        void Retire(T* object)
+        {
+            retire(object, [](void* pointer) { delete static_cast<T*>(pointer); });
+        }
+
+        uint64_t Epoch() const { return m_epoch.load(std::memory_order_relaxed); }
+
+        // Objects handed to Retire() and the ones actually freed so far
+        uint64_t RetiredCount() const { return m_retired.load(std::memory_order_relaxed); }
+        uint64_t FreedCount() const { return m_freed.load(std::memory_order_relaxed); }
+
+        // Advances the epoch as far as the pinned threads allow and frees what the calling
+        // thread and exited threads retired. For quiescent points and tests, Retire()
+        // already does this every CollectInterval calls.
+        void Collect()
+        {
+            ThreadRecord& record = local();
+            for (int i = 0; i < 3 && tryAdvance(); ++i) { }
+            collect(record);
+        }
+
+    private:
+        // Retired objects are collected every this many calls to Retire()
+        static constexpr uint32_t CollectInterval = 64;
+
+        struct Retired
+        {
+            void* Object;
+            void (*Deleter)(void*);
+            uint64_t Epoch;
+        };
+
+        // One bag per epoch modulo 3: when epoch e reuses a bag, its content is
+        // from e - 3 or earlier and therefore safe to free
+        struct Bag
+        {
+            uint64_t Epoch = 0;
+            std::vector<Retired> Items;
+        };
+
+        // Padded so that pinning never invalidates another thread's line
+        struct alignas(CacheLineSize) ThreadRecord
+        {
+            // (epoch << 1) | 1 while pinned, 0 otherwise
+            std::atomic<uint64_t> State = 0;
+            std::atomic<bool> InUse = true;
+            ThreadRecord* Next = nullptr;
+
+            // Only touched by the owning thread
+            uint32_t Nesting = 0;
+            uint32_t RetiresSinceCollect = 0;
+            std::array<Bag, 3> Bags;
+        };
+
+        // Releases the thread's record when the thread exits
+        struct LocalRecord
+        {
+            ThreadRecord* Record = nullptr;
+            EpochDomain* Domain = nullptr;
+
+            ~LocalRecord()
+            {
+                if (Record)
+                    Domain->release(*Record);
+            }
+        };
+
+        EpochDomain() = default;
+
+        ThreadRecord& local()
+        {
+            // A single domain per process, so one thread-local slot is enough
+            static thread_local LocalRecord t_record;
+            if (!t_record.Record)
+            {
+                t_record.Record = acquireRecord();
+                t_record.Domain = this;
+            }
+            return *t_record.Record;
+        }
+
+        ThreadRecord* acquireRecord()
+        {
+            // Reuse the record of a thread that exited
+            for (ThreadRecord* record = m_records.load(); record; record = record->Next)
+            {
+                bool free = false;
+                if (!record->InUse.load(std::memory_order_relaxed)
+                    && record->InUse.compare_exchange_strong(free, true, std::memory_order_acquire))
+                    return record;
+            }
+
+            ThreadRecord* record = new ThreadRecord();
+            ThreadRecord* head = m_records.load();
+            do
+            {
+                record->Next = head;
+            } while (!m_records.compare_exchange_weak(head, record));
+            return record;
+        }
+
+        void release(ThreadRecord& record)
+        {
+            {
+                // The last pins of this thread are gone, the epoch can still be behind
+                std::lock_guard<std::mutex> lock(m_orphansMutex);
+                for (Bag& bag : record.Bags)
+                {
+                    m_orphans.insert(m_orphans.end(), bag.Items.begin(), bag.Items.end());
+                    bag.Items.clear();
+                }
+            }
+            record.State.store(0);
+            record.Nesting = 0;
+            record.RetiresSinceCollect = 0;
+            record.InUse.store(false, std::memory_order_release);
+        }
+
+        void enter()
+        {
+            ThreadRecord& record = local();
+            if (record.Nesting++ > 0)
+                return;
+
+            // Announce the epoch we saw, then check it didn't move meanwhile. If an advance
+            // slipped in between, announcing the new epoch is what lets the next one happen.
+            uint64_t epoch = m_epoch.load();
+            while (true)
+            {
+                record.State.store((epoch << 1) | 1);
+                uint64_t current = m_epoch.load();
+                if (current == epoch)
+                    break;
+                epoch = current;
+            }
+        }
+
+        void leave()
+        {
+            ThreadRecord& record = local();
+            if (--record.Nesting == 0)
+                record.State.store(0, std::memory_order_release);
+        }
+
+        void retire(void* object, void (*deleter)(void*))
+        {
+            ThreadRecord& record = local();
+            const uint64_t epoch = m_epoch.load();
+            m_retired.fetch_add(1, std::memory_order_relaxed);
+
+            Bag& bag = record.Bags[epoch % 3];
+            if (bag.Epoch != epoch)
+            {
+                freeAll(bag.Items);
+                bag.Epoch = epoch;
+            }
+            bag.Items.push_back(Retired { object, deleter, epoch });
+
+            if (++record.RetiresSinceCollect >= CollectInterval)
+            {
+                record.RetiresSinceCollect = 0;
+                tryAdvance();
+                collect(record);
+            }
+        }
+
+        // Moves the global epoch forward if every pinned thread has seen it
+        bool tryAdvance()
+        {
+            uint64_t epoch = m_epoch.load();
+            for (ThreadRecord* record = m_records.load(); record; record = record->Next)
+            {
+                uint64_t state = record->State.load();
+                if ((state & 1) && (state >> 1) != epoch)
+                    return false;
+            }
+            return m_epoch.compare_exchange_strong(epoch, epoch + 1);
+        }
+
+        void collect(ThreadRecord& record)
+        {
+            const uint64_t epoch = m_epoch.load();
+            for (Bag& bag : record.Bags)
+            {
+                if (!bag.Items.empty() && bag.Epoch + 2 <= epoch)
+                    freeAll(bag.Items);
+            }
+
+            // Whatever exited threads left behind, unless somebody else is on it
+            std::unique_lock<std::mutex> lock(m_orphansMutex, std::try_to_lock);
+            if (!lock.owns_lock() || m_orphans.empty())
+                return;
+
+            std::vector<Retired> expired;
+            auto alive = std::partition(m_orphans.begin(), m_orphans.end(), [epoch](const Retired& item) { return item.Epoch + 2 > epoch; });
+            expired.assign(alive, m_orphans.end());
+            m_orphans.erase(alive, m_orphans.end());
+            lock.unlock();
+
+            freeAll(expired);
+        }
+
+        void freeAll(std::vector<Retired>& items)
+        {
+            for (const Retired& item : items)
+                item.Deleter(item.Object);
+            m_freed.fetch_add(items.size(), std::memory_order_relaxed);
+            items.clear();
+        }
+
+        std::atomic<uint64_t> m_epoch = 0;
+        std::atomic<ThreadRecord*> m_records = nullptr;
+
+        std::mutex m_orphansMutex;
+        std::vector<Retired> m_orphans;
+
+        std::atomic<uint64_t> m_retired = 0;
+        std::atomic<uint64_t> m_freed = 0;
+    };
+}
+
+#endif // THREADS_EPOCH_RECLAMATION_HPP_
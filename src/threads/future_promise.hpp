@@ -1,5 +1,7 @@
 #pragma once
 
+#include "simd_reduce.hpp"
+
 #include <chrono>
 #include <future>
 #include <iostream>
@@ -12,12 +14,13 @@ namespace Threads::FuturePromise
    
     void Accumulate(std::vector<int>::iterator first,
                     std::vector<int>::iterator last,
-                    std::promise<int> accumulatePromise)
+                    std::promise<int64_t> accumulatePromise)
     {
         std::cout << "Start Accumulate" << std::endl;
 
         std::this_thread::sleep_for(std::chrono::seconds(1));
-        int sum = std::accumulate(first, last, 0);
+        // Vectorized, and widened so that large inputs don't overflow
+        int64_t sum = Simd::Sum(first, last);
         accumulatePromise.set_value(sum); // Notify future
 
         std::cout << "End Accumulate" << std::endl;
@@ -35,11 +38,11 @@ namespace Threads::FuturePromise
     
     void TestFuturePromise()
     {
-        // Demonstrate using promise<int> to transmit a result between threads.
+        // Demonstrate using promise<int64_t> to transmit a result between threads.
         std::vector<int> numbers = { 1, 2, 3, 4, 5, 6 };
         
-        std::promise<int> accumulatePromise;
-        std::future<int> accumulateFuture = accumulatePromise.get_future();
+        std::promise<int64_t> accumulatePromise;
+        std::future<int64_t> accumulateFuture = accumulatePromise.get_future();
         
         std::cout << "Start workThread" << std::endl;
 
@@ -0,0 +1,50 @@
+#pragma once
+#ifndef THREADS_HARDWARE_HPP_
+#define THREADS_HARDWARE_HPP_
+
+#include <cstddef>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+#endif
+
+namespace Threads
+{
+    // Size of a cache line on the CPUs we target. std::hardware_destructive_interference_size
+    // is the portable spelling, but its value may change with -mtune, so it must not be used
+    // for the layout of types that are shared between translation units.
+    inline constexpr std::size_t CacheLineSize = 64;
+
+    // Tells the CPU that we are inside a spin-wait loop. On x86 this is PAUSE, which saves
+    // power and avoids the memory-order mis-speculation penalty when the loop exits.
+    inline void CpuRelax() noexcept
+    {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(_M_ARM64)
+        __yield();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    // "file.cpp:42" for a lock declared there, the default name of profiled and ordered mutexes
+    inline std::string LockSiteName(const std::source_location& location)
+    {
+        std::string_view file = location.file_name();
+        size_t slash = file.find_last_of("/\\");
+        if (slash != std::string_view::npos)
+            file.remove_prefix(slash + 1);
+        return std::string(file) + ":" + std::to_string(location.line());
+    }
+}
+
+#endif // THREADS_HARDWARE_HPP_
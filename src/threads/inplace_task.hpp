@@ -0,0 +1,123 @@
+#pragma once
+#ifndef THREADS_INPLACE_TASK_HPP_
+#define THREADS_INPLACE_TASK_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Threads
+{
+    // Move-only replacement for std::function<void()>. Callables up to Capacity bytes
+    // are stored inside the task itself, so enqueueing a typical lambda never touches
+    // the heap. Bigger callables still work, they are just moved to the heap.
+    template <size_t Capacity = 64>
+    class InplaceTask
+    {
+    public:
+        template <typename F>
+        static constexpr bool FitsInline = sizeof(F) <= Capacity
+                                        && alignof(F) <= alignof(std::max_align_t)
+                                        && std::is_nothrow_move_constructible_v<F>;
+
+        InplaceTask() noexcept = default;
+
+        template <typename F>
+            requires (!std::is_same_v<std::decay_t<F>, InplaceTask> && std::is_invocable_v<std::decay_t<F>&>)
+        InplaceTask(F&& callable)
+        {
+            using Callable = std::decay_t<F>;
+
+            if constexpr (FitsInline<Callable>)
+            {
+                ::new (static_cast<void*>(m_storage)) Callable(std::forward<F>(callable));
+                m_ops = &s_inlineOps<Callable>;
+            }
+            else
+            {
+                Callable* heapCallable = new Callable(std::forward<F>(callable));
+                ::new (static_cast<void*>(m_storage)) Callable*(heapCallable);
+                m_ops = &s_heapOps<Callable>;
+                s_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        InplaceTask(InplaceTask&& other) noexcept { moveFrom(other); }
+
+        InplaceTask& operator=(InplaceTask&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                moveFrom(other);
+            }
+            return *this;
+        }
+
+        InplaceTask(const InplaceTask&) = delete;
+        InplaceTask& operator=(const InplaceTask&) = delete;
+
+        ~InplaceTask() { reset(); }
+
+        void operator()() { m_ops->Invoke(m_storage); }
+
+        explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+        // How many tasks had to put their callable on the heap since the program
+        // started. Only the fallback path pays for the counter.
+        static size_t HeapAllocations() noexcept { return s_heapAllocations.load(std::memory_order_relaxed); }
+
+    private:
+        struct Ops
+        {
+            void (*Invoke)(void* storage);
+            void (*Move)(void* from, void* to) noexcept;
+            void (*Destroy)(void* storage) noexcept;
+        };
+
+        template <typename Callable>
+        static constexpr Ops s_inlineOps =
+        {
+            [](void* storage) { (*static_cast<Callable*>(storage))(); },
+            [](void* from, void* to) noexcept
+            {
+                Callable* source = static_cast<Callable*>(from);
+                ::new (to) Callable(std::move(*source));
+                source->~Callable();
+            },
+            [](void* storage) noexcept { static_cast<Callable*>(storage)->~Callable(); }
+        };
+
+        template <typename Callable>
+        static constexpr Ops s_heapOps =
+        {
+            [](void* storage) { (**static_cast<Callable**>(storage))(); },
+            [](void* from, void* to) noexcept { ::new (to) Callable*(*static_cast<Callable**>(from)); },
+            [](void* storage) noexcept { delete *static_cast<Callable**>(storage); }
+        };
+
+        void moveFrom(InplaceTask& other) noexcept
+        {
+            if (other.m_ops)
+            {
+                other.m_ops->Move(other.m_storage, m_storage);
+                m_ops = std::exchange(other.m_ops, nullptr);
+            }
+        }
+
+        void reset() noexcept
+        {
+            if (m_ops)
+                std::exchange(m_ops, nullptr)->Destroy(m_storage);
+        }
+
+        alignas(std::max_align_t) std::byte m_storage[Capacity];
+        const Ops* m_ops = nullptr;
+
+        static inline std::atomic<size_t> s_heapAllocations = 0;
+    };
+}
+
+#endif // THREADS_INPLACE_TASK_HPP_
@@ -0,0 +1,75 @@
+#pragma once
+#ifndef THREADS_LATENCY_HISTOGRAM_HPP_
+#define THREADS_LATENCY_HISTOGRAM_HPP_
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+
+namespace Threads
+{
+    // Plain copy of a LatencyHistogram that can be inspected at leisure
+    struct HistogramSnapshot
+    {
+        // Bucket 0 counts zero-length samples, bucket i counts [2^(i-1), 2^i) nanoseconds
+        std::array<uint64_t, 65> Buckets = { };
+        uint64_t Count = 0;
+
+        // Upper bound of the bucket holding the p-th percentile (p in [0, 100]).
+        // Power-of-two buckets make it accurate to within a factor of two.
+        std::chrono::nanoseconds Percentile(double p) const
+        {
+            if (Count == 0)
+                return std::chrono::nanoseconds(0);
+
+            uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(Count - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < Buckets.size(); ++i)
+            {
+                seen += Buckets[i];
+                if (seen >= rank)
+                    return std::chrono::nanoseconds(i == 0 ? 0 : (i >= 63 ? INT64_MAX : (int64_t(1) << i) - 1));
+            }
+            return std::chrono::nanoseconds(INT64_MAX);
+        }
+
+        HistogramSnapshot& operator+=(const HistogramSnapshot& other)
+        {
+            for (size_t i = 0; i < Buckets.size(); ++i)
+                Buckets[i] += other.Buckets[i];
+            Count += other.Count;
+            return *this;
+        }
+    };
+
+    // Log2-bucketed histogram of durations. Recording is one relaxed increment,
+    // so it can be updated from a hot path and read concurrently by a monitor.
+    class LatencyHistogram
+    {
+    public:
+        void Record(std::chrono::nanoseconds duration)
+        {
+            uint64_t ns = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+            m_buckets[std::bit_width(ns)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        HistogramSnapshot Snapshot() const
+        {
+            HistogramSnapshot snapshot;
+            for (size_t i = 0; i < m_buckets.size(); ++i)
+            {
+                snapshot.Buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+                snapshot.Count += snapshot.Buckets[i];
+            }
+            return snapshot;
+        }
+
+    private:
+        // bit_width() of a 64-bit value is 0..64; anything above 2^63 ns shares the last bucket
+        std::array<std::atomic<uint64_t>, 65> m_buckets = { };
+    };
+}
+
+#endif // THREADS_LATENCY_HISTOGRAM_HPP_
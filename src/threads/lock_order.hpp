@@ -0,0 +1,401 @@
+#pragma once
+#ifndef THREADS_LOCK_ORDER_HPP_
+#define THREADS_LOCK_ORDER_HPP_
+
+#include "hardware.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Lock-order checking is on in debug builds and compiled out with NDEBUG, like assert().
+// Define THREADS_LOCK_ORDER_CHECKS to 0 or 1 to override.
+#ifndef THREADS_LOCK_ORDER_CHECKS
+    #ifdef NDEBUG
+        #define THREADS_LOCK_ORDER_CHECKS 0
+    #else
+        #define THREADS_LOCK_ORDER_CHECKS 1
+    #endif
+#endif
+
+#if THREADS_LOCK_ORDER_CHECKS && defined(__has_include)
+    #if __has_include(<execinfo.h>)
+        #include <execinfo.h>
+        #define THREADS_LOCK_ORDER_BACKTRACE 1
+    #endif
+#endif
+#ifndef THREADS_LOCK_ORDER_BACKTRACE
+    #define THREADS_LOCK_ORDER_BACKTRACE 0
+#endif
+
+namespace Threads
+{
+    // Where a lock was taken while another one was held
+    struct LockSite
+    {
+        std::string Held;
+        std::string Acquired;
+        std::thread::id Thread;
+        // Symbolized frames, innermost first; empty where backtraces aren't available
+        std::vector<std::string> Stack;
+    };
+
+    // Taking Acquired while holding Held closes a cycle: Existing is the chain of earlier
+    // acquisitions that already ordered Acquired before Held. Two threads running both paths
+    // at the same time can deadlock, even if this run didn't.
+    struct LockOrderViolation
+    {
+        LockSite Current;
+        std::vector<LockSite> Existing;
+    };
+
+    inline std::ostream& operator<<(std::ostream& out, const LockOrderViolation& violation)
+    {
+        auto printSite = [&out](const LockSite& site)
+        {
+            out << "    " << site.Held << " -> " << site.Acquired << " (thread " << site.Thread << ")" << std::endl;
+            for (const std::string& frame : site.Stack)
+                out << "        " << frame << std::endl;
+        };
+
+        out << "[LockOrder] potential deadlock: lock order inversion" << std::endl;
+        out << "  acquiring now:" << std::endl;
+        printSite(violation.Current);
+        out << "  conflicts with the earlier order:" << std::endl;
+        for (const LockSite& site : violation.Existing)
+            printSite(site);
+        return out;
+    }
+
+    // Time a thread spent waiting for OrderedMutex locks
+    struct ThreadBlockedTime
+    {
+        std::thread::id Thread;
+        uint64_t Waits = 0;
+        std::chrono::nanoseconds Total { 0 };
+        std::chrono::nanoseconds Longest { 0 };
+    };
+
+#if THREADS_LOCK_ORDER_CHECKS
+
+    // Process-wide graph of "acquired B while holding A" edges between lock instances.
+    // A new edge that closes a cycle is reported before the thread blocks on the lock, so
+    // an inversion shows up on the first run that takes both paths, deadlock or not.
+    class LockOrderGraph
+    {
+    public:
+        using Handler = std::function<void(const LockOrderViolation&)>;
+
+        static LockOrderGraph& Global()
+        {
+            static LockOrderGraph graph;
+            return graph;
+        }
+
+        // Replaces the default handler, which prints the violation to std::cerr
+        void SetHandler(Handler handler)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_handler = std::move(handler);
+        }
+
+        uint64_t ViolationCount() const { return m_violations.load(std::memory_order_relaxed); }
+
+        std::vector<ThreadBlockedTime> BlockedTimes() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::vector<ThreadBlockedTime> times;
+            for (const auto& [thread, time] : m_blocked)
+                times.push_back(time);
+            return times;
+        }
+
+        uint64_t AddLock(std::string name)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const uint64_t id = m_nextId++;
+            m_names.emplace(id, std::move(name));
+            return id;
+        }
+
+        void RemoveLock(uint64_t id)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_names.erase(id);
+            m_edges.erase(id);
+            for (auto& [from, targets] : m_edges)
+                targets.erase(id);
+        }
+
+        // Called before blocking on a lock
+        void BeforeLock(uint64_t id)
+        {
+            std::vector<uint64_t>& held = heldLocks();
+            if (held.empty() || std::find(held.begin(), held.end(), id) != held.end())
+                return;
+
+            std::vector<LockOrderViolation> violations;
+            Handler handler;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (uint64_t from : held)
+                {
+                    auto& targets = m_edges[from];
+                    if (targets.contains(id))
+                        continue;
+
+                    // Does the lock we're about to take already come before one we hold?
+                    std::vector<uint64_t> path;
+                    std::unordered_set<uint64_t> visited;
+                    if (findPath(id, from, path, visited))
+                    {
+                        LockOrderViolation violation;
+                        violation.Current = LockSite { m_names[from], m_names[id], std::this_thread::get_id(), captureStack() };
+                        for (size_t i = 0; i + 1 < path.size(); ++i)
+                            violation.Existing.push_back(m_edges[path[i]][path[i + 1]]);
+                        violations.push_back(std::move(violation));
+                    }
+
+                    // Recorded even after a violation, so the same inversion is reported once
+                    targets.emplace(id, LockSite { m_names[from], m_names[id], std::this_thread::get_id(), captureStack() });
+                }
+                handler = m_handler;
+            }
+
+            for (const LockOrderViolation& violation : violations)
+            {
+                m_violations.fetch_add(1, std::memory_order_relaxed);
+                if (handler)
+                    handler(violation);
+                else
+                    std::cerr << violation;
+            }
+        }
+
+        // Called once the lock is held, through lock() or a successful try_lock()
+        void Acquired(uint64_t id) { heldLocks().push_back(id); }
+
+        void Released(uint64_t id)
+        {
+            // Usually the innermost lock, but unlocking out of order is legal
+            std::vector<uint64_t>& held = heldLocks();
+            auto it = std::find(held.rbegin(), held.rend(), id);
+            if (it != held.rend())
+                held.erase(std::next(it).base());
+        }
+
+        void Blocked(std::chrono::nanoseconds waited)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ThreadBlockedTime& time = m_blocked[std::this_thread::get_id()];
+            time.Thread = std::this_thread::get_id();
+            time.Waits++;
+            time.Total += waited;
+            time.Longest = std::max(time.Longest, waited);
+        }
+
+    private:
+        LockOrderGraph() = default;
+
+        static std::vector<uint64_t>& heldLocks()
+        {
+            static thread_local std::vector<uint64_t> t_held;
+            return t_held;
+        }
+
+        // Depth-first search for a chain of recorded edges from -> ... -> to
+        bool findPath(uint64_t from, uint64_t to, std::vector<uint64_t>& path, std::unordered_set<uint64_t>& visited)
+        {
+            path.push_back(from);
+            if (from == to)
+                return true;
+
+            if (visited.insert(from).second)
+            {
+                auto edges = m_edges.find(from);
+                if (edges != m_edges.end())
+                {
+                    for (const auto& [next, site] : edges->second)
+                    {
+                        if (findPath(next, to, path, visited))
+                            return true;
+                    }
+                }
+            }
+
+            path.pop_back();
+            return false;
+        }
+
+        static std::vector<std::string> captureStack()
+        {
+            std::vector<std::string> stack;
+#if THREADS_LOCK_ORDER_BACKTRACE
+            void* frames[32];
+            int count = backtrace(frames, 32);
+            if (char** symbols = backtrace_symbols(frames, count))
+            {
+                // Skip captureStack() and BeforeLock() themselves
+                for (int i = 2; i < count; ++i)
+                    stack.emplace_back(symbols[i]);
+                free(symbols);
+            }
+#endif
+            return stack;
+        }
+
+        mutable std::mutex m_mutex;
+        uint64_t m_nextId = 1;
+        std::unordered_map<uint64_t, std::string> m_names;
+        std::unordered_map<uint64_t, std::unordered_map<uint64_t, LockSite>> m_edges;
+        std::unordered_map<std::thread::id, ThreadBlockedTime> m_blocked;
+        Handler m_handler;
+        std::atomic<uint64_t> m_violations = 0;
+    };
+
+    // Mutex wrapper that feeds the lock-order graph. try_lock() never blocks, so it records
+    // the lock as held but adds no ordering; that is also why std::lock and std::scoped_lock
+    // on several OrderedMutexes don't raise false alarms.
+    template <typename M>
+    class OrderedMutex
+    {
+    public:
+        explicit OrderedMutex(std::string_view name = { }, std::source_location location = std::source_location::current())
+            : m_id(LockOrderGraph::Global().AddLock(name.empty() ? LockSiteName(location) : std::string(name)))
+        {
+        }
+
+        ~OrderedMutex() { LockOrderGraph::Global().RemoveLock(m_id); }
+
+        OrderedMutex(const OrderedMutex&) = delete;
+        OrderedMutex& operator=(const OrderedMutex&) = delete;
+
+        void lock()
+        {
+            LockOrderGraph& graph = LockOrderGraph::Global();
+            graph.BeforeLock(m_id);
+
+            if (!m_mutex.try_lock())
+            {
+                auto start = std::chrono::steady_clock::now();
+                m_mutex.lock();
+                graph.Blocked(std::chrono::steady_clock::now() - start);
+            }
+            graph.Acquired(m_id);
+        }
+
+        bool try_lock()
+        {
+            if (!m_mutex.try_lock())
+                return false;
+            LockOrderGraph::Global().Acquired(m_id);
+            return true;
+        }
+
+        void unlock()
+        {
+            LockOrderGraph::Global().Released(m_id);
+            m_mutex.unlock();
+        }
+
+    private:
+        M m_mutex;
+        const uint64_t m_id;
+    };
+
+#else
+
+    // Release builds: nothing is recorded and OrderedMutex<M> is M
+    class LockOrderGraph
+    {
+    public:
+        using Handler = std::function<void(const LockOrderViolation&)>;
+
+        static LockOrderGraph& Global()
+        {
+            static LockOrderGraph graph;
+            return graph;
+        }
+
+        void SetHandler(Handler) { }
+        uint64_t ViolationCount() const { return 0; }
+        std::vector<ThreadBlockedTime> BlockedTimes() const { return { }; }
+    };
+
+    template <typename M>
+    class OrderedMutex : public M
+    {
+    public:
+        explicit OrderedMutex(std::string_view = { }, std::source_location = std::source_location::current()) { }
+    };
+
+#endif
+
+    // The AdvencedLockManagement::moveData pattern done by hand: one path locks (a, b), the
+    // other (b, a). The two paths run one after the other, so nothing deadlocks, yet the
+    // inversion is reported. The same pair through std::scoped_lock stays quiet.
+    void TestLockOrder()
+    {
+#if THREADS_LOCK_ORDER_CHECKS
+        LockOrderGraph& graph = LockOrderGraph::Global();
+        uint64_t reported = 0;
+        graph.SetHandler([&reported](const LockOrderViolation& violation)
+        {
+            ++reported;
+            std::cout << violation;
+        });
+
+        OrderedMutex<std::mutex> source("source");
+        OrderedMutex<std::mutex> target("target");
+
+        std::thread forward([&]
+        {
+            std::lock_guard<OrderedMutex<std::mutex>> first(source);
+            std::lock_guard<OrderedMutex<std::mutex>> second(target);
+        });
+        forward.join();
+        std::thread backward([&]
+        {
+            std::lock_guard<OrderedMutex<std::mutex>> first(target);
+            std::lock_guard<OrderedMutex<std::mutex>> second(source);
+        });
+        backward.join();
+        assert(reported == 1);
+
+        OrderedMutex<std::mutex> left("left");
+        OrderedMutex<std::mutex> right("right");
+        std::thread t1([&] { for (int i = 0; i < 1000; ++i) std::scoped_lock lock(left, right); });
+        std::thread t2([&] { for (int i = 0; i < 1000; ++i) std::scoped_lock lock(right, left); });
+        t1.join();
+        t2.join();
+        assert(reported == 1);
+
+        graph.SetHandler(nullptr);
+        for (const ThreadBlockedTime& time : graph.BlockedTimes())
+        {
+            std::cout << "[LockOrder] thread " << time.Thread << " blocked " << time.Waits << " times, "
+                      << std::chrono::duration_cast<std::chrono::microseconds>(time.Total).count() << " us in total, longest "
+                      << std::chrono::duration_cast<std::chrono::microseconds>(time.Longest).count() << " us" << std::endl;
+        }
+        std::cout << "[LockOrder] " << graph.ViolationCount() << " lock order violation(s) reported" << std::endl;
+#else
+        std::cout << "[LockOrder] compiled out (NDEBUG), OrderedMutex is a plain mutex" << std::endl;
+#endif
+    }
+}
+
+#endif // THREADS_LOCK_ORDER_HPP_
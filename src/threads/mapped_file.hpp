@@ -0,0 +1,213 @@
+#pragma once
+#ifndef THREADS_MAPPED_FILE_HPP_
+#define THREADS_MAPPED_FILE_HPP_
+
+#include "async_file.hpp"
+#include "generator.hpp"
+#include "simd_scan.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if THREADS_ASYNC_FILE_POSIX
+    #include <sys/mman.h>
+#endif
+
+namespace Threads
+{
+    // A window [Offset, Offset + Size) of a file, mapped read-only. Without mmap the
+    // window is read into a buffer instead, which costs a copy but reads the same.
+    class MappedWindow
+    {
+    public:
+        MappedWindow(const AsyncFile& file, uint64_t offset, size_t size) : m_offset(offset), m_size(size)
+        {
+            if (size == 0)
+                return;
+#if THREADS_ASYNC_FILE_POSIX
+            void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file.Descriptor(), static_cast<off_t>(offset));
+            if (data == MAP_FAILED)
+                throw std::system_error(errno, std::generic_category(), "MappedWindow: mmap");
+            // Doubles the kernel's readahead and lets it drop pages behind us early
+            ::madvise(data, size, MADV_SEQUENTIAL);
+            m_data = static_cast<const char*>(data);
+#else
+            m_buffer.resize(size);
+            int64_t read = file.ReadBlocking(m_buffer, offset);
+            if (read < 0)
+                throw std::system_error(static_cast<int>(-read), std::generic_category(), "MappedWindow: read");
+            m_size = static_cast<size_t>(read);
+            m_data = m_buffer.data();
+#endif
+        }
+
+        ~MappedWindow()
+        {
+#if THREADS_ASYNC_FILE_POSIX
+            if (m_data)
+                ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+        }
+
+        MappedWindow(const MappedWindow&) = delete;
+        MappedWindow& operator=(const MappedWindow&) = delete;
+
+        const char* Data() const { return m_data; }
+        size_t Size() const { return m_size; }
+        uint64_t Offset() const { return m_offset; }
+
+    private:
+        const char* m_data = nullptr;
+        uint64_t m_offset;
+        size_t m_size;
+#if !THREADS_ASYNC_FILE_POSIX
+        std::vector<char> m_buffer;
+#endif
+    };
+
+    // Lines of a file straight out of the page cache: the file is mapped a window at a
+    // time and lines are string_views into the mapping, nothing is copied. Only the
+    // window is mapped, so files larger than memory (or than the address space of a
+    // 32-bit process) work too; when a line runs past the window's end, the window slides
+    // forward to start at that line. A line longer than the window doubles it.
+    class MappedLineReader
+    {
+    public:
+        explicit MappedLineReader(const std::string& path, size_t windowSize = size_t(64) << 20,
+                                  Simd::InstructionSet scan = Simd::DetectedInstructionSet())
+            : m_file(path), m_windowSize(std::max(windowSize, PageSize)), m_scan(scan)
+        {
+        }
+
+        uint64_t Size() const { return m_file.Size(); }
+
+        // Lines without their '\n'. A view stays valid until the generator is advanced:
+        // the window it points into may be unmapped by then.
+        Coroutines::Generator<std::string_view> Lines()
+        {
+            Simd::NewlineScanner scanner(m_scan);
+            const uint64_t fileSize = m_file.Size();
+            size_t windowSize = m_windowSize;
+
+            uint64_t lineStart = 0;
+            while (lineStart < fileSize)
+            {
+                // mmap offsets have to be page aligned
+                const uint64_t mapOffset = lineStart - lineStart % PageSize;
+                MappedWindow window(m_file, mapOffset, static_cast<size_t>(std::min<uint64_t>(windowSize, fileSize - mapOffset)));
+                const char* data = window.Data();
+                const size_t size = window.Size();
+                const bool last = mapOffset + size >= fileSize;
+
+                size_t begin = static_cast<size_t>(lineStart - mapOffset);
+                for (size_t chunk = begin; chunk < size; chunk += Simd::NewlineScanner::ChunkSize)
+                {
+                    for (uint32_t offset : scanner.Scan(data + chunk, std::min(Simd::NewlineScanner::ChunkSize, size - chunk)))
+                    {
+                        const size_t end = chunk + offset;
+                        co_yield std::string_view(data + begin, end - begin);
+                        begin = end + 1;
+                    }
+                }
+
+                if (last)
+                {
+                    if (begin < size)
+                        co_yield std::string_view(data + begin, size - begin);
+                    break;
+                }
+
+                if (mapOffset + begin == lineStart)
+                    windowSize *= 2;
+                lineStart = mapOffset + begin;
+            }
+        }
+
+    private:
+        static constexpr size_t PageSize = 64 * 1024;
+
+        AsyncFile m_file;
+        const size_t m_windowSize;
+        const Simd::InstructionSet m_scan;
+    };
+
+    // Line throughput on a generated log file: std::getline into a std::string, the mapped
+    // reader splitting with memchr, and with the dispatched SIMD scan. The file is read once
+    // beforehand, so all three read from the page cache and only the splitting differs.
+    void BenchmarkMappedLineReader(uint64_t megabytes = 1024, std::filesystem::path directory = std::filesystem::temp_directory_path())
+    {
+        using Clock = std::chrono::steady_clock;
+
+        const std::string path = (directory / "threads_mapped_file.log").string();
+        {
+            std::ofstream out(path, std::ios::binary);
+            std::string line;
+            uint64_t seed = 0x2545f4914f6cdd1d;
+            for (uint64_t written = 0; written < megabytes * 1024 * 1024; written += line.size())
+            {
+                seed = seed * 6364136223846793005 + 1442695040888963407;
+                line = "2024-05-01T12:00:00.000Z INFO worker-" + std::to_string(seed % 64) + " status=200 latency_us="
+                     + std::to_string((seed >> 8) % 100000) + std::string((seed >> 40) % 60, '.') + '\n';
+                out << line;
+            }
+        }
+
+        auto report = [](const char* name, uint64_t lines, uint64_t bytes, Clock::duration elapsed)
+        {
+            double seconds = std::chrono::duration<double>(elapsed).count();
+            std::cout << "[MappedFile] " << name << ": " << lines << " lines, "
+                      << static_cast<double>(bytes) / seconds / (1024.0 * 1024.0 * 1024.0) << " GiB/s, "
+                      << static_cast<double>(lines) / seconds / 1e6 << " M lines/s" << std::endl;
+        };
+
+        auto runMapped = [&](const char* name, Simd::InstructionSet scan)
+        {
+            MappedLineReader reader(path, size_t(64) << 20, scan);
+            uint64_t lines = 0;
+            uint64_t bytes = 0;
+            auto start = Clock::now();
+            for (std::string_view line : reader.Lines())
+            {
+                ++lines;
+                bytes += line.size() + 1;
+            }
+            report(name, lines, bytes, Clock::now() - start);
+            return lines;
+        };
+
+        // Warm the page cache
+        runMapped("mmap + memchr, cold", Simd::InstructionSet::Portable);
+
+        uint64_t getlineLines = 0;
+        uint64_t getlineBytes = 0;
+        auto start = Clock::now();
+        {
+            std::ifstream in(path, std::ios::binary);
+            for (std::string line; std::getline(in, line);)
+            {
+                ++getlineLines;
+                getlineBytes += line.size() + 1;
+            }
+        }
+        report("std::ifstream + std::getline", getlineLines, getlineBytes, Clock::now() - start);
+
+        uint64_t memchrLines = runMapped("mmap + memchr", Simd::InstructionSet::Portable);
+        const std::string simdName = std::string("mmap + ") + Simd::ToString(Simd::NewlineKernelSet(Simd::DetectedInstructionSet()));
+        uint64_t simdLines = runMapped(simdName.c_str(), Simd::DetectedInstructionSet());
+        if (memchrLines != getlineLines || simdLines != getlineLines)
+            std::cout << "[MappedFile] line count mismatch" << std::endl;
+
+        std::filesystem::remove(path);
+    }
+}
+
+#endif // THREADS_MAPPED_FILE_HPP_
@@ -0,0 +1,448 @@
+#pragma once
+#ifndef THREADS_MPMC_QUEUE_HPP_
+#define THREADS_MPMC_QUEUE_HPP_
+
+#include "hardware.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Threads
+{
+    // Bounded multi-producer/multi-consumer queue on a power-of-two ring (Dmitry Vyukov's
+    // design). Every slot carries a sequence number that says whose turn it is: a producer
+    // at position p may write the slot when its sequence is p, a consumer may read it when
+    // it is p + 1. Producers and consumers each claim positions with one CAS and never
+    // touch each other's index, so the only shared writes are on the slots themselves.
+    //
+    // The memory is allocated once. A full queue pushes back on producers: TryPush fails,
+    // Push blocks on std::atomic::wait until a consumer made room.
+    //
+    // A claimed position has to be published, or every consumer stops in front of it. So
+    // nothing that may throw runs between claim and publish: values whose constructor can
+    // throw are built before the claim, and T must move and destroy without throwing.
+    template <typename T>
+    class MpmcQueue
+    {
+        static_assert(std::is_nothrow_move_constructible_v<T> && std::is_nothrow_destructible_v<T>,
+                      "MpmcQueue moves values in and out of claimed slots, which must not throw");
+
+    public:
+        // Rounded up to a power of two, at least 2
+        explicit MpmcQueue(size_t capacity)
+            : m_capacity(std::bit_ceil(std::max<size_t>(capacity, 2))), m_mask(m_capacity - 1),
+              m_slots(std::make_unique<Slot[]>(m_capacity))
+        {
+            for (size_t i = 0; i < m_capacity; ++i)
+                m_slots[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+
+        MpmcQueue(const MpmcQueue&) = delete;
+        MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+        ~MpmcQueue()
+        {
+            if constexpr (!std::is_trivially_destructible_v<T>)
+            {
+                while (TryPop()) { }
+            }
+        }
+
+        size_t Capacity() const { return m_capacity; }
+
+        // Approximate, the indices keep moving while we read them
+        size_t Size() const
+        {
+            size_t tail = m_enqueuePos.load(std::memory_order_relaxed);
+            size_t head = m_dequeuePos.load(std::memory_order_relaxed);
+            return tail > head ? std::min(tail - head, m_capacity) : 0;
+        }
+
+        template <typename... Args>
+        bool TryEmplace(Args&&... args)
+        {
+            if constexpr (std::is_nothrow_constructible_v<T, Args&&...>)
+                return tryEmplaceClaimed(std::forward<Args>(args)...);
+            else
+                return tryEmplaceClaimed(T(std::forward<Args>(args)...));
+        }
+
+        bool TryPush(const T& value) { return TryEmplace(value); }
+        bool TryPush(T&& value) { return TryEmplace(std::move(value)); }
+
+        bool TryPop(T& out)
+            requires std::is_nothrow_move_assignable_v<T>
+        {
+            return tryPopWith([&out](T& value) noexcept { out = std::move(value); });
+        }
+
+        // Builds the result in place, so T needs no default constructor
+        std::optional<T> TryPop()
+        {
+            std::optional<T> result;
+            tryPopWith([&result](T& value) noexcept { result.emplace(std::move(value)); });
+            return result;
+        }
+
+        // Pushes up to max(distance(first, last)) values with a single CAS on the
+        // producer index, as many as there are consecutive free slots. Returns how
+        // many were taken from the front of the range, which is read twice: once to
+        // size the claim, once to copy the values. The values are built after the
+        // positions are claimed, so building them must not throw.
+        template <std::forward_iterator It>
+            requires std::is_nothrow_constructible_v<T, std::iter_reference_t<It>>
+        size_t TryPushBatch(It first, It last)
+        {
+            const size_t wanted = static_cast<size_t>(std::distance(first, last));
+            size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+            size_t count = 0;
+            while (true)
+            {
+                // Free slots stay free until somebody claims their position, which
+                // our CAS below rules out, so counting them first is safe
+                count = 0;
+                while (count < wanted && m_slots[(pos + count) & m_mask].Sequence.load() == pos + count)
+                    ++count;
+
+                if (count == 0)
+                {
+                    // Either full, or another producer moved the index under us
+                    const size_t current = m_enqueuePos.load(std::memory_order_relaxed);
+                    if (current == pos)
+                        return 0;
+                    pos = current;
+                    continue;
+                }
+
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+                    break;
+            }
+
+            for (size_t i = 0; i < count; ++i, ++first)
+            {
+                Slot& slot = m_slots[(pos + i) & m_mask];
+                std::construct_at(slot.Value(), *first);
+                slot.Sequence.store(pos + i + 1);
+            }
+            wakeConsumers(count);
+            return count;
+        }
+
+        // Pops up to max values with a single CAS on the consumer index. Returns how many
+        // were written to out.
+        template <std::output_iterator<T> Out>
+        size_t TryPopBatch(Out out, size_t max)
+        {
+            size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+            size_t count = 0;
+            while (true)
+            {
+                count = 0;
+                while (count < max && m_slots[(pos + count) & m_mask].Sequence.load() == pos + count + 1)
+                    ++count;
+
+                if (count == 0)
+                {
+                    const size_t current = m_dequeuePos.load(std::memory_order_relaxed);
+                    if (current == pos)
+                        return 0;
+                    pos = current;
+                    continue;
+                }
+
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+                    break;
+            }
+
+            size_t i = 0;
+            try
+            {
+                for (; i < count; ++i)
+                {
+                    Slot& slot = m_slots[(pos + i) & m_mask];
+                    *out++ = std::move(*slot.Value());
+                    std::destroy_at(slot.Value());
+                    slot.Sequence.store(pos + i + m_capacity);
+                }
+            }
+            catch (...)
+            {
+                // The output threw, e.g. a back_inserter out of memory. The values it didn't
+                // take are lost, but their slots still go back to the producers.
+                for (; i < count; ++i)
+                {
+                    Slot& slot = m_slots[(pos + i) & m_mask];
+                    std::destroy_at(slot.Value());
+                    slot.Sequence.store(pos + i + m_capacity);
+                }
+                wakeProducers(count);
+                throw;
+            }
+            wakeProducers(count);
+            return count;
+        }
+
+        // Blocks while the queue is full
+        void Push(T value)
+        {
+            waitUntil(m_popEpoch, m_pushWaiters, [&] { return TryPush(std::move(value)); });
+        }
+
+        // Blocks while the queue is empty
+        T Pop()
+        {
+            std::optional<T> value;
+            waitUntil(m_pushEpoch, m_popWaiters, [&]
+            {
+                return tryPopWith([&value](T& popped) noexcept { value.emplace(std::move(popped)); });
+            });
+            return std::move(*value);
+        }
+
+    private:
+        // Only called with arguments that T is built from without throwing
+        template <typename... Args>
+        bool tryEmplaceClaimed(Args&&... args)
+        {
+            size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Slot& slot = m_slots[pos & m_mask];
+                const size_t sequence = slot.Sequence.load();
+                const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+                if (diff == 0)
+                {
+                    if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        std::construct_at(slot.Value(), std::forward<Args>(args)...);
+                        slot.Sequence.store(pos + 1);
+                        wakeConsumers(1);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    // The consumer of the previous lap hasn't freed the slot: full
+                    return false;
+                }
+                else
+                {
+                    pos = m_enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // take(value) moves the value out and must not throw
+        template <typename Take>
+        bool tryPopWith(Take&& take)
+        {
+            size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Slot& slot = m_slots[pos & m_mask];
+                const size_t sequence = slot.Sequence.load();
+                const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+
+                if (diff == 0)
+                {
+                    if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        take(*slot.Value());
+                        std::destroy_at(slot.Value());
+                        // Hand the slot to the producer of the next lap
+                        slot.Sequence.store(pos + m_capacity);
+                        wakeProducers(1);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    // The producer of this position hasn't published yet: empty
+                    return false;
+                }
+                else
+                {
+                    pos = m_dequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        struct Slot
+        {
+            std::atomic<size_t> Sequence;
+            alignas(T) std::byte Storage[sizeof(T)];
+
+            T* Value() { return std::launder(reinterpret_cast<T*>(Storage)); }
+        };
+
+        // Spins briefly, then parks on the epoch the other side bumps. Slot sequences and
+        // waiter counts are all sequentially consistent, so a waiter that registers before
+        // its last attempt can't be missed: either wake() sees it registered, or the last
+        // attempt sees the slot that wake() was called for. On x86 that costs the
+        // publishing stores an XCHG instead of a MOV, loads are free either way.
+        template <typename Attempt>
+        void waitUntil(std::atomic<uint32_t>& epoch, std::atomic<uint32_t>& waiters, Attempt&& attempt)
+        {
+            static constexpr int SpinCount = 64;
+            static constexpr int YieldCount = 16;
+            for (int i = 0; i < SpinCount + YieldCount; ++i)
+            {
+                if (attempt())
+                    return;
+                // Yielding lets the other side run when we share a core with it
+                if (i < SpinCount)
+                    CpuRelax();
+                else
+                    std::this_thread::yield();
+            }
+
+            while (true)
+            {
+                waiters.fetch_add(1);
+                const uint32_t seen = epoch.load();
+                if (attempt())
+                {
+                    waiters.fetch_sub(1);
+                    return;
+                }
+                epoch.wait(seen);
+                waiters.fetch_sub(1);
+
+                if (attempt())
+                    return;
+            }
+        }
+
+        void wake(std::atomic<uint32_t>& epoch, std::atomic<uint32_t>& waiters, size_t count)
+        {
+            if (waiters.load() == 0)
+                return;
+
+            epoch.fetch_add(1);
+            if (count == 1)
+                epoch.notify_one();
+            else
+                epoch.notify_all();
+        }
+
+        void wakeConsumers(size_t count) { wake(m_pushEpoch, m_popWaiters, count); }
+        void wakeProducers(size_t count) { wake(m_popEpoch, m_pushWaiters, count); }
+
+        const size_t m_capacity;
+        const size_t m_mask;
+        std::unique_ptr<Slot[]> m_slots;
+
+        // Producers and consumers each get their own cache lines
+        alignas(CacheLineSize) std::atomic<size_t> m_enqueuePos = 0;
+        alignas(CacheLineSize) std::atomic<size_t> m_dequeuePos = 0;
+
+        alignas(CacheLineSize) std::atomic<uint32_t> m_pushEpoch = 0;
+        std::atomic<uint32_t> m_popWaiters = 0;
+        alignas(CacheLineSize) std::atomic<uint32_t> m_popEpoch = 0;
+        std::atomic<uint32_t> m_pushWaiters = 0;
+    };
+
+    // The baseline: std::queue behind one mutex, with condition variables for the
+    // same blocking and backpressure behaviour
+    template <typename T>
+    class LockedBoundedQueue
+    {
+    public:
+        explicit LockedBoundedQueue(size_t capacity) : m_capacity(capacity) { }
+
+        void Push(T value)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notFull.wait(lock, [this] { return m_queue.size() < m_capacity; });
+            m_queue.push(std::move(value));
+            lock.unlock();
+            m_notEmpty.notify_one();
+        }
+
+        T Pop()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this] { return !m_queue.empty(); });
+            T value = std::move(m_queue.front());
+            m_queue.pop();
+            lock.unlock();
+            m_notFull.notify_one();
+            return value;
+        }
+
+    private:
+        const size_t m_capacity;
+        std::mutex m_mutex;
+        std::condition_variable m_notEmpty;
+        std::condition_variable m_notFull;
+        std::queue<T> m_queue;
+    };
+
+    // Moves the same number of messages through both queues with 1 to 16 producer/consumer
+    // pairs. The ring is small on purpose, so that producers hit backpressure regularly.
+    void BenchmarkMpmcQueue(size_t messages = 2'000'000, size_t capacity = 1024)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        auto run = [messages](auto& queue, size_t pairs)
+        {
+            const size_t perProducer = messages / pairs;
+            std::atomic<uint64_t> checksum = 0;
+
+            auto start = Clock::now();
+            std::vector<std::thread> threads;
+            for (size_t p = 0; p < pairs; ++p)
+            {
+                threads.emplace_back([&queue, perProducer]
+                {
+                    for (size_t i = 1; i <= perProducer; ++i)
+                        queue.Push(i);
+                });
+                threads.emplace_back([&queue, &checksum, perProducer]
+                {
+                    uint64_t sum = 0;
+                    for (size_t i = 0; i < perProducer; ++i)
+                        sum += queue.Pop();
+                    checksum.fetch_add(sum);
+                });
+            }
+            for (auto& thread : threads)
+                thread.join();
+
+            auto elapsed = Clock::now() - start;
+            assert(checksum.load() == pairs * perProducer * (perProducer + 1) / 2);
+            return static_cast<double>(pairs * perProducer) / std::chrono::duration<double>(elapsed).count() / 1e6;
+        };
+
+        for (size_t pairs : { 1, 2, 4, 8, 16 })
+        {
+            MpmcQueue<uint64_t> ring(capacity);
+            LockedBoundedQueue<uint64_t> locked(capacity);
+
+            double ringRate = run(ring, pairs);
+            double lockedRate = run(locked, pairs);
+            std::cout << "[MPMC] " << pairs << " producer/consumer pairs: ring " << ringRate
+                      << " Mmsg/s, mutex + std::queue " << lockedRate << " Mmsg/s" << std::endl;
+        }
+    }
+}
+
+#endif // THREADS_MPMC_QUEUE_HPP_
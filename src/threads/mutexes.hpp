@@ -2,6 +2,8 @@
 #ifndef THREADS_MUTEXES_HPP_
 #define THREADS_MUTEXES_HPP_
 
+#include "reentrant_mutex.hpp"
+
 #include <iostream>
 #include <format>
 #include <mutex>
@@ -256,7 +258,7 @@ namespace Threads
 
         void addAndDouble(int val)
         {
-            std::lock_guard<std::recursive_mutex> lock(m_mutex); // Acquires lock (1st time)
+            std::lock_guard<ReentrantMutex> lock(m_mutex); // Acquires lock (1st time)
             std::cout << "Thread " << std::this_thread::get_id()
                       << ": add_and_double, value before: " << m_value << std::endl;
 
@@ -269,20 +271,21 @@ namespace Threads
 
         int GetValue()
         {
-            std::lock_guard<std::recursive_mutex> lock(m_mutex);
+            std::lock_guard<ReentrantMutex> lock(m_mutex);
             return m_value;
         }
 
     private:
         void internalAdd(int val)
         {
-            std::lock_guard<std::recursive_mutex> lock(m_mutex); // Acquires lock (2nd time if called by add_and_double)
+            std::lock_guard<ReentrantMutex> lock(m_mutex); // Acquires lock (2nd time if called by add_and_double)
             m_value += val;
             std::cout << "Thread " << std::this_thread::get_id()
                       << ": Internal add, value now: " << m_value << std::endl;
         }
 
-        std::recursive_mutex m_mutex;
+        // Re-entry by the owner is a compare and an increment, see reentrant_mutex.hpp
+        ReentrantMutex m_mutex;
         int m_value = 0;
     };
 
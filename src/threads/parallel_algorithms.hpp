@@ -0,0 +1,395 @@
+#pragma once
+#ifndef THREADS_PARALLEL_ALGORITHMS_HPP_
+#define THREADS_PARALLEL_ALGORITHMS_HPP_
+
+#include "async.hpp"
+#include "simd_reduce.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+namespace Threads::Parallel
+{
+    // A chunk should run long enough to amortize claiming it, and short enough that the
+    // last chunks still balance out between the workers
+    inline constexpr std::chrono::nanoseconds TargetChunkTime = std::chrono::microseconds(50);
+
+    // Upper bound for the serial probe that measures the cost of one element
+    inline constexpr std::chrono::nanoseconds ProbeTime = std::chrono::microseconds(20);
+
+    // Every worker should get at least this many chunks to steal from each other
+    inline constexpr size_t ChunksPerWorker = 4;
+
+    // The range [First, First + Count) cut into Chunks pieces of Grain indices. Workers
+    // claim the next chunk with one fetch_add, so a worker that got slow chunks simply
+    // claims fewer of them: no upfront split can end up with one straggler.
+    template <typename ChunkFn>
+    class ChunkState
+    {
+    public:
+        ChunkState(ChunkFn& chunkFn, size_t first, size_t count, size_t grain)
+            : m_chunkFn(&chunkFn), m_first(first), m_count(count), m_grain(grain),
+              m_chunks((count + grain - 1) / grain) { }
+
+        size_t Chunks() const { return m_chunks; }
+
+        // Runs chunks until none is left to claim. Once that happened the function
+        // object is never touched again, so it may go away with the caller's frame.
+        void Work()
+        {
+            while (true)
+            {
+                const size_t chunk = m_next.fetch_add(1, std::memory_order_relaxed);
+                if (chunk >= m_chunks)
+                    return;
+
+                const size_t begin = m_first + chunk * m_grain;
+                const size_t end = std::min(begin + m_grain, m_first + m_count);
+
+                // After a failure the remaining chunks are only counted down
+                if (!m_failed.load(std::memory_order_relaxed))
+                {
+                    try
+                    {
+                        (*m_chunkFn)(chunk, begin, end);
+                    }
+                    catch (...)
+                    {
+                        if (!m_failed.exchange(true))
+                            m_error = std::current_exception();
+                    }
+                }
+
+                if (m_completed.fetch_add(1, std::memory_order_acq_rel) + 1 == m_chunks)
+                {
+                    m_finished.store(1, std::memory_order_release);
+                    m_finished.notify_all();
+                }
+            }
+        }
+
+        // Helps the pool until every chunk finished, then rethrows the first exception
+        void Wait(ThreadPool& pool)
+        {
+            while (m_finished.load(std::memory_order_acquire) == 0)
+            {
+                // Only chunks that somebody is already running are left: nothing we
+                // do can speed them up, but other queued tasks may be waiting for a core
+                if (!pool.RunPendingTask())
+                    m_finished.wait(0, std::memory_order_acquire);
+            }
+
+            if (m_error)
+                std::rethrow_exception(m_error);
+        }
+
+    private:
+        ChunkFn* m_chunkFn;
+        const size_t m_first;
+        const size_t m_count;
+        const size_t m_grain;
+        const size_t m_chunks;
+
+        alignas(CacheLineSize) std::atomic<size_t> m_next = 0;
+        alignas(CacheLineSize) std::atomic<size_t> m_completed = 0;
+        std::atomic<uint32_t> m_finished = 0;
+        std::atomic<bool> m_failed = false;
+        std::exception_ptr m_error;
+    };
+
+    // Runs chunkFn(chunk, begin, end) for every chunk of [first, first + count) on the pool
+    // and the calling thread. Returns when all chunks finished.
+    template <typename ChunkFn>
+    void RunChunks(ThreadPool& pool, size_t first, size_t count, size_t grain, ChunkFn& chunkFn)
+    {
+        if (count == 0)
+            return;
+
+        // Shared with the helper tasks, some of which may only start after we returned
+        auto state = std::make_shared<ChunkState<ChunkFn>>(chunkFn, first, count, std::max<size_t>(grain, 1));
+
+        // The calling thread works too, so one chunk needs no helper at all
+        const size_t helpers = std::min(pool.ThreadCount(), state->Chunks() - 1);
+        for (size_t i = 0; i < helpers; ++i)
+            pool.Enqueue([state] { state->Work(); });
+
+        state->Work();
+        state->Wait(pool);
+    }
+
+    // Runs rangeFn(begin, end) serially on growing pieces of [0, count) until either
+    // ProbeTime passed or the probe reached its share of the range. Returns how many
+    // indices were processed and the grain that makes a chunk last TargetChunkTime.
+    template <typename RangeFn>
+    std::pair<size_t, size_t> ProbeGrain(ThreadPool& pool, size_t count, RangeFn& rangeFn)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        const size_t workers = pool.ThreadCount() + 1;
+        const size_t limit = count / (workers * ChunksPerWorker * 2);
+
+        size_t done = 0;
+        size_t step = 1;
+        Clock::duration elapsed { 0 };
+        while (done < limit && elapsed < ProbeTime)
+        {
+            const size_t n = std::min(step, limit - done);
+            const Clock::time_point start = Clock::now();
+            rangeFn(done, done + n);
+            elapsed += Clock::now() - start;
+
+            done += n;
+            step *= 2;
+        }
+
+        // Never fewer than ChunksPerWorker chunks per worker, however cheap an element is
+        const size_t remaining = count - done;
+        const size_t balanced = std::max<size_t>((remaining + workers * ChunksPerWorker - 1) / (workers * ChunksPerWorker), 1);
+
+        const auto perElement = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed) / std::max<size_t>(done, 1);
+        if (done == 0 || perElement.count() == 0)
+            return { done, balanced };
+
+        const size_t timed = static_cast<size_t>(TargetChunkTime / perElement);
+        return { done, std::clamp<size_t>(timed, 1, balanced) };
+    }
+
+    // Calls body(i) for every i in [first, last). With grain 0 the chunk size is tuned
+    // from the measured cost of the first few calls, which run on the calling thread.
+    template <typename Index, typename Body>
+        requires std::is_integral_v<Index> && std::is_invocable_v<Body&, Index>
+    void ParallelFor(ThreadPool& pool, Index first, Index last, Body&& body, size_t grain = 0)
+    {
+        if (last <= first)
+            return;
+
+        const size_t count = static_cast<size_t>(last - first);
+        auto rangeFn = [&body, first](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+                std::invoke(body, static_cast<Index>(first + static_cast<Index>(i)));
+        };
+
+        size_t head = 0;
+        if (grain == 0)
+            std::tie(head, grain) = ProbeGrain(pool, count, rangeFn);
+
+        auto chunkFn = [&rangeFn](size_t, size_t begin, size_t end) { rangeFn(begin, end); };
+        RunChunks(pool, head, count - head, grain, chunkFn);
+    }
+
+    // transform(*it) for every element, folded with reduce. Chunks are combined in
+    // order, so reduce has to be associative but not commutative.
+    template <std::random_access_iterator RandomIt, typename T, typename Reduce, typename Transform>
+    T ParallelTransformReduce(ThreadPool& pool, RandomIt first, RandomIt last, T init,
+                              Reduce reduce, Transform transform, size_t grain = 0)
+    {
+        const size_t count = static_cast<size_t>(std::distance(first, last));
+        if (count == 0)
+            return init;
+
+        auto foldRange = [&](size_t begin, size_t end)
+        {
+            T acc = transform(first[begin]);
+            for (size_t i = begin + 1; i < end; ++i)
+                acc = reduce(std::move(acc), transform(first[i]));
+            return acc;
+        };
+
+        // The probe's pieces are folded right away, they are the leftmost elements
+        std::optional<T> headResult;
+        auto probeFn = [&](size_t begin, size_t end)
+        {
+            T part = foldRange(begin, end);
+            headResult = headResult ? reduce(std::move(*headResult), std::move(part)) : std::move(part);
+        };
+
+        size_t head = 0;
+        if (grain == 0)
+            std::tie(head, grain) = ProbeGrain(pool, count, probeFn);
+        grain = std::max<size_t>(grain, 1);
+
+        // One slot per chunk, each written by exactly one worker
+        std::vector<std::optional<T>> partials((count - head + grain - 1) / grain);
+        auto chunkFn = [&](size_t chunk, size_t begin, size_t end)
+        {
+            partials[chunk].emplace(foldRange(begin, end));
+        };
+        RunChunks(pool, head, count - head, grain, chunkFn);
+
+        T result = std::move(init);
+        if (headResult)
+            result = reduce(std::move(result), std::move(*headResult));
+        for (std::optional<T>& partial : partials)
+            result = reduce(std::move(result), std::move(*partial));
+        return result;
+    }
+
+    template <std::random_access_iterator RandomIt, typename T, typename Reduce = std::plus<>>
+    T ParallelReduce(ThreadPool& pool, RandomIt first, RandomIt last, T init,
+                     Reduce reduce = Reduce(), size_t grain = 0)
+    {
+        // Converting up front lets T widen the elements, e.g. summing ints into an int64_t
+        return ParallelTransformReduce(pool, first, last, std::move(init), std::move(reduce),
+                                       [](const auto& value) { return static_cast<T>(value); }, grain);
+    }
+
+    // Sum in the widened Simd::SumType, every chunk runs the vectorized kernel. The
+    // elements are cheap enough that no probe is needed: chunks of 64K elements keep
+    // the claim overhead far below the time it takes to stream them from memory.
+    template <std::random_access_iterator RandomIt>
+    Simd::SumType<std::iter_value_t<RandomIt>> ParallelSum(ThreadPool& pool, RandomIt first, RandomIt last, size_t grain = 0)
+    {
+        using Result = Simd::SumType<std::iter_value_t<RandomIt>>;
+
+        const size_t count = static_cast<size_t>(std::distance(first, last));
+        if (grain == 0)
+        {
+            const size_t workers = pool.ThreadCount() + 1;
+            grain = std::max<size_t>((count + workers * ChunksPerWorker - 1) / (workers * ChunksPerWorker), 64 * 1024);
+        }
+
+        std::vector<Result> partials((count + grain - 1) / grain);
+        auto chunkFn = [&](size_t chunk, size_t begin, size_t end)
+        {
+            partials[chunk] = Simd::Sum(first + begin, first + end);
+        };
+        RunChunks(pool, 0, count, grain, chunkFn);
+
+        return std::accumulate(partials.begin(), partials.end(), Result());
+    }
+
+    // out[i] = in[0] op in[1] op ... op in[i]. Two passes over fixed blocks: the first
+    // reduces every block, a serial scan over the block sums gives each block its carry,
+    // and the second pass scans the blocks independently starting from their carry.
+    // Returns the end of the output range, like std::inclusive_scan.
+    template <std::random_access_iterator InputIt, std::random_access_iterator OutputIt, typename Op = std::plus<>>
+    OutputIt ParallelInclusiveScan(ThreadPool& pool, InputIt first, InputIt last, OutputIt out,
+                                   Op op = Op(), size_t grain = 0)
+    {
+        using T = typename std::iterator_traits<InputIt>::value_type;
+
+        const size_t count = static_cast<size_t>(std::distance(first, last));
+        if (count == 0)
+            return out;
+
+        // Both passes need the same blocks, so there is no probe: scanning costs
+        // about the same per element everywhere
+        if (grain == 0)
+        {
+            const size_t workers = pool.ThreadCount() + 1;
+            grain = std::max<size_t>((count + workers * ChunksPerWorker - 1) / (workers * ChunksPerWorker), 4096);
+        }
+
+        const size_t blocks = (count + grain - 1) / grain;
+        if (blocks == 1)
+            return std::inclusive_scan(first, last, out, op);
+
+        std::vector<std::optional<T>> sums(blocks);
+        auto reduceFn = [&](size_t block, size_t begin, size_t end)
+        {
+            T acc = first[begin];
+            for (size_t i = begin + 1; i < end; ++i)
+                acc = op(std::move(acc), first[i]);
+            sums[block].emplace(std::move(acc));
+        };
+        // The last block's sum is never used as a carry
+        RunChunks(pool, 0, (blocks - 1) * grain, grain, reduceFn);
+
+        // From here on sums[b] is the carry of block b + 1: everything up to and including b
+        for (size_t block = 1; block < blocks - 1; ++block)
+            sums[block] = op(std::move(*sums[block - 1]), std::move(*sums[block]));
+
+        auto scanFn = [&](size_t block, size_t begin, size_t end)
+        {
+            if (block == 0)
+            {
+                std::inclusive_scan(first + begin, first + end, out + begin, op);
+                return;
+            }
+            std::inclusive_scan(first + begin, first + end, out + begin, op, *sums[block - 1]);
+        };
+        RunChunks(pool, 0, count, grain, scanFn);
+
+        return out + count;
+    }
+
+    // Sums the same vector of ones with Async::ParallelSum, which starts a thread per
+    // leaf, and with the pool-based algorithms. At 1B elements the thread-per-leaf
+    // version typically runs out of threads before it runs out of work.
+    void BenchmarkParallelAlgorithms(std::vector<size_t> sizes = { 10'000'000, 1'000'000'000 })
+    {
+        using Clock = std::chrono::steady_clock;
+        using Milli = std::chrono::milliseconds;
+
+        ThreadPool pool(std::max<size_t>(std::thread::hardware_concurrency(), 1), SchedulingMode::WorkStealing);
+
+        auto measure = [](const char* name, size_t size, auto&& run)
+        {
+            auto start = Clock::now();
+            try
+            {
+                auto result = run();
+                std::cout << "[Parallel] " << size << " elements, " << name << ": "
+                          << std::chrono::duration_cast<Milli>(Clock::now() - start).count()
+                          << " ms, result " << result << std::endl;
+            }
+            catch (const std::system_error& e)
+            {
+                std::cout << "[Parallel] " << size << " elements, " << name << ": failed after "
+                          << std::chrono::duration_cast<Milli>(Clock::now() - start).count()
+                          << " ms (" << e.what() << ")" << std::endl;
+            }
+        };
+
+        for (size_t size : sizes)
+        {
+            std::vector<int> values;
+            try
+            {
+                values.assign(size, 1);
+            }
+            catch (const std::bad_alloc&)
+            {
+                std::cout << "[Parallel] " << size << " elements don't fit in memory, skipped" << std::endl;
+                continue;
+            }
+
+            measure("Async::ParallelSum", size, [&] { return Async::ParallelSum(values.begin(), values.end()); });
+            measure("std::accumulate", size, [&] { return std::accumulate(values.begin(), values.end(), int64_t(0)); });
+            measure("ParallelReduce", size, [&] { return ParallelReduce(pool, values.begin(), values.end(), int64_t(0)); });
+            measure("Parallel::ParallelSum (SIMD)", size, [&] { return ParallelSum(pool, values.begin(), values.end()); });
+            measure("ParallelTransformReduce (sum of squares)", size, [&]
+            {
+                return ParallelTransformReduce(pool, values.begin(), values.end(), int64_t(0), std::plus<>(),
+                                               [](int value) { return int64_t(value) * value; });
+            });
+            measure("ParallelFor (in-place doubling)", size, [&]
+            {
+                ParallelFor(pool, size_t(0), values.size(), [&values](size_t i) { values[i] *= 2; });
+                return values.back();
+            });
+            measure("ParallelInclusiveScan (in place)", size, [&]
+            {
+                ParallelInclusiveScan(pool, values.begin(), values.end(), values.begin());
+                return values.back();
+            });
+        }
+    }
+}
+
+#endif // THREADS_PARALLEL_ALGORITHMS_HPP_
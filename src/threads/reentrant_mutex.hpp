@@ -0,0 +1,278 @@
+#pragma once
+#ifndef THREADS_REENTRANT_MUTEX_HPP_
+#define THREADS_REENTRANT_MUTEX_HPP_
+
+#include "hardware.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Threads
+{
+    // Non-zero and unique among running threads: the address of a thread-local.
+    // Cheaper than std::this_thread::get_id(), which calls into pthread_self().
+    inline uintptr_t CurrentThreadToken() noexcept
+    {
+        static thread_local char t_token;
+        return reinterpret_cast<uintptr_t>(&t_token);
+    }
+
+    // Recursive mutex with a user-space fast path for every case but a real wait.
+    //
+    // Re-entry compares the owner field with the caller's thread token and bumps a depth
+    // counter that only the owner touches, no atomic read-modify-write. Only the owner can
+    // have stored its own token, so a relaxed load is enough to recognize it.
+    //
+    // A contended lock() first spins for a while, adapting the spin length to how long
+    // recent acquisitions took (like glibc's PTHREAD_MUTEX_ADAPTIVE_NP), then parks on
+    // std::atomic::wait. unlock() only notifies when somebody parked.
+    class ReentrantMutex
+    {
+    public:
+        ReentrantMutex() = default;
+        ReentrantMutex(const ReentrantMutex&) = delete;
+        ReentrantMutex& operator=(const ReentrantMutex&) = delete;
+
+        void lock()
+        {
+            const uintptr_t self = CurrentThreadToken();
+            if (m_owner.load(std::memory_order_relaxed) == self)
+            {
+                ++m_depth;
+                return;
+            }
+
+            uint32_t expected = Unlocked;
+            if (!m_state.compare_exchange_strong(expected, Locked, std::memory_order_acquire, std::memory_order_relaxed))
+                lockContended();
+
+            m_owner.store(self, std::memory_order_relaxed);
+            m_depth = 1;
+        }
+
+        bool try_lock()
+        {
+            const uintptr_t self = CurrentThreadToken();
+            if (m_owner.load(std::memory_order_relaxed) == self)
+            {
+                ++m_depth;
+                return true;
+            }
+
+            uint32_t expected = Unlocked;
+            if (!m_state.compare_exchange_strong(expected, Locked, std::memory_order_acquire, std::memory_order_relaxed))
+                return false;
+
+            m_owner.store(self, std::memory_order_relaxed);
+            m_depth = 1;
+            return true;
+        }
+
+        void unlock()
+        {
+            assert(m_owner.load(std::memory_order_relaxed) == CurrentThreadToken());
+            if (--m_depth > 0)
+                return;
+
+            m_owner.store(0, std::memory_order_relaxed);
+            if (m_state.exchange(Unlocked, std::memory_order_release) == LockedWithWaiters)
+                m_state.notify_one();
+        }
+
+    private:
+        static constexpr uint32_t Unlocked = 0;
+        static constexpr uint32_t Locked = 1;
+        static constexpr uint32_t LockedWithWaiters = 2;
+        static constexpr uint32_t MaxSpins = 4000;
+
+        void lockContended()
+        {
+            // Spin up to twice as long as acquisitions took lately
+            const uint32_t spinLimit = m_spinLimit.load(std::memory_order_relaxed);
+            const uint32_t maxSpins = std::min(MaxSpins, spinLimit * 2 + 10);
+            uint32_t spins = 0;
+            for (; spins < maxSpins; ++spins)
+            {
+                uint32_t expected = Unlocked;
+                if (m_state.load(std::memory_order_relaxed) == Unlocked
+                    && m_state.compare_exchange_weak(expected, Locked, std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    m_spinLimit.store(spinLimit + (static_cast<int32_t>(spins) - static_cast<int32_t>(spinLimit)) / 8, std::memory_order_relaxed);
+                    return;
+                }
+                CpuRelax();
+            }
+            m_spinLimit.store(spinLimit + (static_cast<int32_t>(maxSpins) - static_cast<int32_t>(spinLimit)) / 8, std::memory_order_relaxed);
+
+            // Whoever takes the lock from here on marks it as having waiters, so the
+            // eventual unlock() wakes the next one of us
+            while (m_state.exchange(LockedWithWaiters, std::memory_order_acquire) != Unlocked)
+                m_state.wait(LockedWithWaiters, std::memory_order_relaxed);
+        }
+
+        alignas(CacheLineSize) std::atomic<uint32_t> m_state = Unlocked;
+        std::atomic<uintptr_t> m_owner = 0;
+        // Owner-only
+        uint32_t m_depth = 0;
+        std::atomic<uint32_t> m_spinLimit = 100;
+    };
+
+    // Value plus the mutex that guards it, reachable only through the lock. Splitting a class
+    // into public functions that lock once and internal ones that take the unlocked state
+    // removes the reason for a recursive mutex in the first place:
+    //
+    //     void AddAndDouble(int val)
+    //     {
+    //         m_state.WithLock([&](State& state) { add(state, val); add(state, state.Value); });
+    //     }
+    //     static void add(State& state, int val) { state.Value += val; }
+    //
+    // The internal functions can't be called without the state, and the state can't be
+    // reached without the lock.
+    template <typename T, typename Mutex = std::mutex>
+    class Synchronized
+    {
+    public:
+        // Grants access to the value while it exists
+        class LockedPtr
+        {
+        public:
+            T* operator->() const { return m_value; }
+            T& operator*() const { return *m_value; }
+
+        private:
+            friend class Synchronized;
+            LockedPtr(Mutex& mutex, T& value) : m_lock(mutex), m_value(&value) { }
+
+            std::unique_lock<Mutex> m_lock;
+            T* m_value;
+        };
+
+        template <typename... Args>
+        explicit Synchronized(Args&&... args) : m_value(std::forward<Args>(args)...) { }
+
+        Synchronized(const Synchronized&) = delete;
+        Synchronized& operator=(const Synchronized&) = delete;
+
+        LockedPtr Lock() { return LockedPtr(m_mutex, m_value); }
+
+        template <typename F>
+        decltype(auto) WithLock(F&& func)
+        {
+            std::lock_guard<Mutex> lock(m_mutex);
+            return func(m_value);
+        }
+
+    private:
+        Mutex m_mutex;
+        T m_value;
+    };
+
+    // SafeContainer from mutexes.hpp without the printing: addAndDouble() locks, then
+    // internalAdd() locks the same mutex twice more; readers call getValue()
+    template <typename Mutex>
+    class ReentrantContainer
+    {
+    public:
+        void addAndDouble(int val)
+        {
+            std::lock_guard<Mutex> lock(m_mutex);
+            internalAdd(val);
+            internalAdd(m_value);
+        }
+
+        int getValue()
+        {
+            std::lock_guard<Mutex> lock(m_mutex);
+            return m_value;
+        }
+
+    private:
+        void internalAdd(int val)
+        {
+            std::lock_guard<Mutex> lock(m_mutex);
+            m_value = (m_value + val) & 0xffff;
+        }
+
+        Mutex m_mutex;
+        int m_value = 0;
+    };
+
+    // The same container with the locked/unlocked split, no reentrancy at all
+    class SplitContainer
+    {
+    public:
+        void addAndDouble(int val)
+        {
+            m_state.WithLock([val](int& value)
+            {
+                add(value, val);
+                add(value, value);
+            });
+        }
+
+        int getValue() { return m_state.WithLock([](int& value) { return value; }); }
+
+    private:
+        static void add(int& value, int val) { value = (value + val) & 0xffff; }
+
+        Synchronized<int> m_state;
+    };
+
+    // Each thread mixes three addAndDouble() calls with one getValue() call
+    void BenchmarkReentrantMutex(int operations = 2'000'000)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        auto run = [operations](auto& container, size_t threadCount)
+        {
+            const int perThread = operations / static_cast<int>(threadCount);
+            std::atomic<int64_t> checksum = 0;
+
+            std::vector<std::thread> threads;
+            auto start = Clock::now();
+            for (size_t t = 0; t < threadCount; ++t)
+            {
+                threads.emplace_back([&container, &checksum, perThread]
+                {
+                    int64_t seen = 0;
+                    for (int i = 0; i < perThread; ++i)
+                    {
+                        if (i % 4 == 3)
+                            seen += container.getValue();
+                        else
+                            container.addAndDouble(i & 7);
+                    }
+                    checksum.fetch_add(seen);
+                });
+            }
+            for (auto& thread : threads)
+                thread.join();
+
+            double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+            return ns / (static_cast<double>(perThread) * static_cast<double>(threadCount));
+        };
+
+        size_t maxThreads = std::max<size_t>(std::thread::hardware_concurrency(), 8);
+        for (size_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+        {
+            ReentrantContainer<std::recursive_mutex> recursive;
+            ReentrantContainer<ReentrantMutex> reentrant;
+            SplitContainer split;
+
+            std::cout << "[Reentrant] " << threadCount << " threads (ns/op): std::recursive_mutex " << run(recursive, threadCount)
+                      << ", ReentrantMutex " << run(reentrant, threadCount)
+                      << ", std::mutex with split API " << run(split, threadCount) << std::endl;
+        }
+    }
+}
+
+#endif // THREADS_REENTRANT_MUTEX_HPP_
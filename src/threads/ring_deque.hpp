@@ -0,0 +1,104 @@
+#pragma once
+#ifndef THREADS_RING_DEQUE_HPP_
+#define THREADS_RING_DEQUE_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace Threads
+{
+    // Double-ended queue on top of one power-of-two circular buffer. Unlike std::deque,
+    // which allocates and frees a block every few elements, it only allocates when it
+    // grows, so a queue that reached its working size never touches the heap again.
+    // Not thread-safe: the owner is expected to guard it with a lock.
+    template <typename T>
+    class RingDeque
+    {
+    public:
+        RingDeque() = default;
+
+        RingDeque(const RingDeque&) = delete;
+        RingDeque& operator=(const RingDeque&) = delete;
+
+        ~RingDeque()
+        {
+            Clear();
+            if (m_buffer)
+                std::allocator<T>().deallocate(m_buffer, m_capacity);
+        }
+
+        template <typename... Args>
+        T& EmplaceBack(Args&&... args)
+        {
+            if (m_size == m_capacity)
+                grow();
+
+            T* slot = std::construct_at(m_buffer + ((m_head + m_size) & (m_capacity - 1)), std::forward<Args>(args)...);
+            ++m_size;
+            return *slot;
+        }
+
+        T PopFront()
+        {
+            T* slot = m_buffer + m_head;
+            T value = std::move(*slot);
+            std::destroy_at(slot);
+
+            m_head = (m_head + 1) & (m_capacity - 1);
+            --m_size;
+            return value;
+        }
+
+        T PopBack()
+        {
+            T* slot = m_buffer + ((m_head + m_size - 1) & (m_capacity - 1));
+            T value = std::move(*slot);
+            std::destroy_at(slot);
+
+            --m_size;
+            return value;
+        }
+
+        T& Front() { return m_buffer[m_head]; }
+
+        void Clear()
+        {
+            while (m_size > 0)
+                std::destroy_at(m_buffer + ((m_head + --m_size) & (m_capacity - 1)));
+            m_head = 0;
+        }
+
+        size_t Size() const { return m_size; }
+        size_t Capacity() const { return m_capacity; }
+        bool Empty() const { return m_size == 0; }
+
+    private:
+        void grow()
+        {
+            size_t capacity = m_capacity ? m_capacity * 2 : 16;
+            T* buffer = std::allocator<T>().allocate(capacity);
+
+            for (size_t i = 0; i < m_size; ++i)
+            {
+                T* slot = m_buffer + ((m_head + i) & (m_capacity - 1));
+                std::construct_at(buffer + i, std::move(*slot));
+                std::destroy_at(slot);
+            }
+
+            if (m_buffer)
+                std::allocator<T>().deallocate(m_buffer, m_capacity);
+
+            m_buffer = buffer;
+            m_capacity = capacity;
+            m_head = 0;
+        }
+
+        T* m_buffer = nullptr;
+        size_t m_capacity = 0;
+        size_t m_head = 0;
+        size_t m_size = 0;
+    };
+}
+
+#endif // THREADS_RING_DEQUE_HPP_
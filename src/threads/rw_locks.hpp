@@ -0,0 +1,288 @@
+#pragma once
+#ifndef THREADS_RW_LOCKS_HPP_
+#define THREADS_RW_LOCKS_HPP_
+
+#include "epoch_reclamation.hpp"
+#include "hardware.hpp"
+#include "sharded_counter.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Threads
+{
+    // Reader-writer lock for data that is read all the time and written rarely (a big-reader
+    // lock). std::shared_mutex keeps one reader count, so every lock_shared() writes the same
+    // cache line and readers on different cores serialize on it. Here every thread counts
+    // itself into its own padded slot; readers only read the shared writer flag, which stays
+    // cached everywhere until a writer shows up.
+    //
+    // Writers prefer themselves: once a writer raised the flag, new readers wait for it, so a
+    // steady stream of readers can't starve writers. A writer pays for the scalability by
+    // visiting every slot. Meets SharedLockable, use it with std::shared_lock/std::unique_lock.
+    class DistributedSharedMutex
+    {
+    public:
+        // Rounded up to a power of two, 0 means one per hardware thread
+        explicit DistributedSharedMutex(size_t slots = 0)
+            : m_slotCount(std::bit_ceil(std::max<size_t>(slots ? slots : std::thread::hardware_concurrency(), 1))),
+              m_mask(m_slotCount - 1), m_slots(std::make_unique<Slot[]>(m_slotCount))
+        {
+        }
+
+        DistributedSharedMutex(const DistributedSharedMutex&) = delete;
+        DistributedSharedMutex& operator=(const DistributedSharedMutex&) = delete;
+
+        void lock_shared()
+        {
+            std::atomic<uint32_t>& readers = slot();
+            while (true)
+            {
+                if (m_writer.load(std::memory_order_relaxed))
+                    m_writer.wait(true);
+
+                // Count ourselves in, then check no writer came meanwhile. Both sides are
+                // sequentially consistent: either the writer sees our count, or we see its flag.
+                readers.fetch_add(1);
+                if (!m_writer.load())
+                    return;
+
+                leave(readers);
+            }
+        }
+
+        bool try_lock_shared()
+        {
+            if (m_writer.load())
+                return false;
+
+            std::atomic<uint32_t>& readers = slot();
+            readers.fetch_add(1);
+            if (!m_writer.load())
+                return true;
+
+            leave(readers);
+            return false;
+        }
+
+        void unlock_shared() { leave(slot()); }
+
+        void lock()
+        {
+            m_writerMutex.lock();
+            m_writer.store(true);
+            drainReaders();
+        }
+
+        bool try_lock()
+        {
+            if (!m_writerMutex.try_lock())
+                return false;
+
+            m_writer.store(true);
+            for (size_t i = 0; i < m_slotCount; ++i)
+            {
+                if (m_slots[i].Readers.load() != 0)
+                {
+                    unlock();
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void unlock()
+        {
+            m_writer.store(false);
+            m_writer.notify_all();
+            m_writerMutex.unlock();
+        }
+
+    private:
+        struct alignas(CacheLineSize) Slot
+        {
+            std::atomic<uint32_t> Readers = 0;
+        };
+
+        // Threads keep their slot for life, so lock_shared() and unlock_shared() agree
+        std::atomic<uint32_t>& slot() { return m_slots[ThreadShardIndex() & m_mask].Readers; }
+
+        // The last reader of a slot wakes a writer draining it
+        void leave(std::atomic<uint32_t>& readers)
+        {
+            if (readers.fetch_sub(1) == 1 && m_writer.load())
+                readers.notify_all();
+        }
+
+        void drainReaders()
+        {
+            for (size_t i = 0; i < m_slotCount; ++i)
+            {
+                std::atomic<uint32_t>& readers = m_slots[i].Readers;
+                for (uint32_t count = readers.load(); count != 0; count = readers.load())
+                    readers.wait(count);
+            }
+        }
+
+        const size_t m_slotCount;
+        const size_t m_mask;
+        const std::unique_ptr<Slot[]> m_slots;
+
+        // Read by every reader, written once per write: keep it away from anything else
+        alignas(CacheLineSize) std::atomic<bool> m_writer = false;
+        std::mutex m_writerMutex;
+    };
+
+    // RCU-style cell for read-mostly values such as configuration. Readers get a pointer to
+    // an immutable snapshot and never write anything shared: no lock word, no reference
+    // count, just a pin of the calling thread's own epoch record. Writers copy the current
+    // value, modify the copy and publish it; the old value is freed by the epoch domain once
+    // no reader can still hold it.
+    template <typename T>
+    class ReadMostly
+    {
+    public:
+        // Keeps the value it points to alive while it exists. Keep it short-lived:
+        // a reader that stays pinned holds back reclamation for everybody.
+        class Snapshot
+        {
+        public:
+            const T& operator*() const { return *m_value; }
+            const T* operator->() const { return m_value; }
+            const T* Get() const { return m_value; }
+
+        private:
+            friend class ReadMostly;
+            Snapshot(EpochDomain::Guard guard, const T* value) : m_guard(std::move(guard)), m_value(value) { }
+
+            EpochDomain::Guard m_guard;
+            const T* m_value;
+        };
+
+        explicit ReadMostly(T value = T()) : m_current(new T(std::move(value))) { }
+
+        // Nobody may read any more, the last value can go right away
+        ~ReadMostly() { delete m_current.load(std::memory_order_relaxed); }
+
+        ReadMostly(const ReadMostly&) = delete;
+        ReadMostly& operator=(const ReadMostly&) = delete;
+
+        Snapshot Read() const
+        {
+            EpochDomain::Guard guard = m_domain.Pin();
+            return Snapshot(std::move(guard), m_current.load(std::memory_order_acquire));
+        }
+
+        // Copies the current value, lets update modify the copy and publishes it.
+        // Writers are serialized, so no update is lost.
+        template <typename F>
+        void Update(F&& update)
+        {
+            std::lock_guard<std::mutex> lock(m_writerMutex);
+            auto next = std::make_unique<T>(*m_current.load(std::memory_order_relaxed));
+            update(*next);
+            publish(next.release());
+        }
+
+        void Store(T value)
+        {
+            std::lock_guard<std::mutex> lock(m_writerMutex);
+            publish(new T(std::move(value)));
+        }
+
+    private:
+        void publish(T* next)
+        {
+            T* previous = m_current.exchange(next, std::memory_order_acq_rel);
+            m_domain.Retire(previous);
+        }
+
+        alignas(CacheLineSize) std::atomic<T*> m_current;
+        EpochDomain& m_domain = EpochDomain::Global();
+        std::mutex m_writerMutex;
+    };
+
+    // Readers look at a config string in a loop while one writer replaces it every
+    // millisecond, the ReaderWriterLock scenario from mutexes.hpp at scale
+    void BenchmarkReadMostly(std::chrono::milliseconds duration = std::chrono::milliseconds(200))
+    {
+        using Clock = std::chrono::steady_clock;
+
+        auto run = [duration](size_t readerCount, auto&& read, auto&& write)
+        {
+            std::atomic<bool> stop = false;
+            std::atomic<uint64_t> totalReads = 0;
+
+            std::vector<std::thread> readers;
+            for (size_t r = 0; r < readerCount; ++r)
+            {
+                readers.emplace_back([&]
+                {
+                    uint64_t reads = 0;
+                    size_t checksum = 0;
+                    while (!stop.load(std::memory_order_relaxed))
+                    {
+                        checksum += read();
+                        ++reads;
+                    }
+                    totalReads.fetch_add(reads + (checksum == 0 ? 1 : 0));
+                });
+            }
+
+            std::thread writer([&]
+            {
+                for (int version = 0; !stop.load(std::memory_order_relaxed); ++version)
+                {
+                    write("Config version " + std::to_string(version));
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            });
+
+            auto start = Clock::now();
+            std::this_thread::sleep_for(duration);
+            stop.store(true);
+            for (auto& reader : readers)
+                reader.join();
+            writer.join();
+
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            return static_cast<double>(totalReads.load()) / seconds / 1e6;
+        };
+
+        for (size_t readerCount = 1; readerCount <= 64; readerCount *= 2)
+        {
+            std::string sharedConfig = "Initial Config Value";
+            std::shared_mutex sharedMutex;
+            double sharedMutexRate = run(readerCount,
+                [&] { std::shared_lock<std::shared_mutex> lock(sharedMutex); return sharedConfig.size(); },
+                [&](std::string value) { std::unique_lock<std::shared_mutex> lock(sharedMutex); sharedConfig = std::move(value); });
+
+            std::string distributedConfig = "Initial Config Value";
+            DistributedSharedMutex distributedMutex;
+            double distributedRate = run(readerCount,
+                [&] { std::shared_lock<DistributedSharedMutex> lock(distributedMutex); return distributedConfig.size(); },
+                [&](std::string value) { std::unique_lock<DistributedSharedMutex> lock(distributedMutex); distributedConfig = std::move(value); });
+
+            ReadMostly<std::string> readMostly("Initial Config Value");
+            double readMostlyRate = run(readerCount,
+                [&] { return readMostly.Read()->size(); },
+                [&](std::string value) { readMostly.Store(std::move(value)); });
+
+            std::cout << "[ReadMostly] " << readerCount << " readers (M reads/s): std::shared_mutex " << sharedMutexRate
+                      << ", DistributedSharedMutex " << distributedRate << ", ReadMostly " << readMostlyRate << std::endl;
+        }
+    }
+}
+
+#endif // THREADS_RW_LOCKS_HPP_
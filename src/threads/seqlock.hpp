@@ -0,0 +1,277 @@
+#pragma once
+#ifndef THREADS_SEQLOCK_HPP_
+#define THREADS_SEQLOCK_HPP_
+
+#include "hardware.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Threads
+{
+    // Sequence lock for small trivially-copyable state (timestamps, counters, config structs)
+    // that is read far more often than written. Readers don't write anything shared: they
+    // read the sequence, copy the value, and read the sequence again; if a writer was active
+    // (odd sequence) or finished meanwhile (sequence changed), they simply retry. Writers
+    // make the sequence odd, write, and make it even again.
+    //
+    // Readers never block writers, so a writer can't starve, but a reader can retry for as
+    // long as writes keep landing on top of it. Keep T small: the copy is the retry window.
+    //
+    // The value lives in atomic words accessed with acquire/release, not in a plain T. A
+    // torn read is then merely discarded instead of being a data race, and the orderings
+    // the protocol needs come from the word accesses themselves; on x86 they are plain MOVs.
+    template <typename T>
+    class SeqLock
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "SeqLock copies T byte-wise");
+
+    public:
+        explicit SeqLock(const T& value = T()) { storeWords(value); }
+
+        SeqLock(const SeqLock&) = delete;
+        SeqLock& operator=(const SeqLock&) = delete;
+
+        T Load() const
+        {
+            T value;
+            while (!TryLoad(value))
+                CpuRelax();
+            return value;
+        }
+
+        // One optimistic attempt, fails if a writer got in the way
+        bool TryLoad(T& out) const
+        {
+            const uint64_t before = m_sequence.load(std::memory_order_acquire);
+            if (before & 1)
+                return false;
+
+            Word words[WordCount];
+            for (size_t i = 0; i < WordCount; ++i)
+                words[i] = m_words[i].load(std::memory_order_acquire);
+
+            // The acquire loads above keep this load from moving up
+            if (m_sequence.load(std::memory_order_relaxed) != before)
+                return false;
+
+            std::memcpy(&out, words, sizeof(T));
+            return true;
+        }
+
+        void Store(const T& value)
+        {
+            const uint64_t sequence = beginWrite();
+            storeWords(value);
+            m_sequence.store(sequence + 2, std::memory_order_release);
+        }
+
+        // Read-modify-write, atomic with respect to other writers
+        template <typename F>
+        void Update(F&& update)
+        {
+            const uint64_t sequence = beginWrite();
+
+            // Nobody else writes now, so this read can't tear
+            Word words[WordCount];
+            for (size_t i = 0; i < WordCount; ++i)
+                words[i] = m_words[i].load(std::memory_order_relaxed);
+            T value;
+            std::memcpy(&value, words, sizeof(T));
+
+            update(value);
+            storeWords(value);
+            m_sequence.store(sequence + 2, std::memory_order_release);
+        }
+
+        // Even while no write is in progress, bumped by two per write
+        uint64_t Sequence() const { return m_sequence.load(std::memory_order_acquire); }
+
+    private:
+        using Word = uint64_t;
+        static constexpr size_t WordCount = (sizeof(T) + sizeof(Word) - 1) / sizeof(Word);
+
+        // Writers exclude each other by making the sequence odd
+        uint64_t beginWrite()
+        {
+            uint64_t sequence = m_sequence.load(std::memory_order_relaxed);
+            while ((sequence & 1) || !m_sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                CpuRelax();
+                sequence = m_sequence.load(std::memory_order_relaxed);
+            }
+            return sequence;
+        }
+
+        // Release stores: a reader that sees any new word also sees the odd sequence
+        void storeWords(const T& value)
+        {
+            Word words[WordCount] = { };
+            std::memcpy(words, &value, sizeof(T));
+            for (size_t i = 0; i < WordCount; ++i)
+                m_words[i].store(words[i], std::memory_order_release);
+        }
+
+        alignas(CacheLineSize) std::atomic<uint64_t> m_sequence = 0;
+        std::atomic<Word> m_words[WordCount];
+    };
+
+    // Writers store values whose fields all derive from one number; a reader that ever sees
+    // a mix of two writes has caught a torn read. Each reader also checks that the versions
+    // it observes never go backwards.
+    void TestSeqLockTorture(size_t readers = 4, size_t writers = 2, std::chrono::milliseconds duration = std::chrono::milliseconds(500))
+    {
+        struct Sample
+        {
+            uint64_t Version;
+            uint64_t Square;
+            uint32_t Low;
+            uint32_t High;
+            uint8_t Tag;
+            uint64_t Checksum;
+        };
+
+        auto make = [](uint64_t version)
+        {
+            Sample sample { version, version * version, static_cast<uint32_t>(version), static_cast<uint32_t>(version >> 32),
+                            static_cast<uint8_t>(version * 7), 0 };
+            sample.Checksum = sample.Version ^ sample.Square ^ sample.Low ^ (uint64_t(sample.High) << 32) ^ sample.Tag;
+            return sample;
+        };
+
+        SeqLock<Sample> lock(make(0));
+        std::atomic<bool> stop = false;
+        std::atomic<uint64_t> reads = 0;
+        std::atomic<uint64_t> torn = 0;
+        std::atomic<uint64_t> backwards = 0;
+
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < writers; ++w)
+        {
+            threads.emplace_back([&]
+            {
+                for (uint64_t i = 1; !stop.load(std::memory_order_relaxed); ++i)
+                {
+                    lock.Update([&](Sample& sample) { sample = make(sample.Version + 1); });
+                    // Back-to-back writes can lock readers out completely where threads share cores
+                    if (i % 64 == 0)
+                        std::this_thread::yield();
+                }
+            });
+        }
+
+        for (size_t r = 0; r < readers; ++r)
+        {
+            threads.emplace_back([&]
+            {
+                uint64_t last = 0;
+                uint64_t count = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    Sample sample = lock.Load();
+                    Sample expected = make(sample.Version);
+                    if (sample.Square != expected.Square || sample.Low != expected.Low || sample.High != expected.High
+                        || sample.Tag != expected.Tag || sample.Checksum != expected.Checksum)
+                        torn.fetch_add(1);
+                    if (sample.Version < last)
+                        backwards.fetch_add(1);
+                    last = sample.Version;
+                    ++count;
+                }
+                reads.fetch_add(count);
+            });
+        }
+
+        std::this_thread::sleep_for(duration);
+        stop.store(true);
+        for (auto& thread : threads)
+            thread.join();
+
+        assert(torn.load() == 0);
+        assert(backwards.load() == 0);
+        std::cout << "[SeqLock] " << reads << " reads of " << lock.Load().Version << " writes, "
+                  << torn << " torn, " << backwards << " out of order" << std::endl;
+    }
+
+    // Readers copy a small stats struct while one writer keeps updating it, like the
+    // ReaderWriterLock example but with a value small enough to copy
+    void BenchmarkSeqLock(std::chrono::milliseconds duration = std::chrono::milliseconds(200))
+    {
+        struct Stats
+        {
+            uint64_t Requests;
+            uint64_t Errors;
+            int64_t LastUpdateNs;
+            double MeanLatency;
+        };
+
+        auto run = [duration](size_t readerCount, auto&& read, auto&& write)
+        {
+            std::atomic<bool> stop = false;
+            std::atomic<uint64_t> totalReads = 0;
+
+            std::vector<std::thread> threads;
+            for (size_t r = 0; r < readerCount; ++r)
+            {
+                threads.emplace_back([&]
+                {
+                    uint64_t count = 0;
+                    uint64_t checksum = 0;
+                    while (!stop.load(std::memory_order_relaxed))
+                    {
+                        checksum += read().Requests;
+                        ++count;
+                    }
+                    totalReads.fetch_add(count + (checksum == 1 ? 1 : 0));
+                });
+            }
+            threads.emplace_back([&]
+            {
+                for (uint64_t i = 0; !stop.load(std::memory_order_relaxed); ++i)
+                {
+                    write(Stats { i, i / 100, static_cast<int64_t>(i) * 1000, 1.5 });
+                    // A write every ~10 us, fast-changing state
+                    for (int spin = 0; spin < 100; ++spin)
+                        CpuRelax();
+                }
+            });
+
+            auto start = std::chrono::steady_clock::now();
+            std::this_thread::sleep_for(duration);
+            stop.store(true);
+            for (auto& thread : threads)
+                thread.join();
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return static_cast<double>(totalReads.load()) / seconds / 1e6;
+        };
+
+        size_t maxReaders = std::max<size_t>(std::thread::hardware_concurrency(), 8);
+        for (size_t readerCount = 1; readerCount <= maxReaders; readerCount *= 2)
+        {
+            SeqLock<Stats> seqLock;
+            double seqLockRate = run(readerCount, [&] { return seqLock.Load(); }, [&](const Stats& stats) { seqLock.Store(stats); });
+
+            Stats shared { };
+            std::shared_mutex mutex;
+            double sharedMutexRate = run(readerCount,
+                [&] { std::shared_lock<std::shared_mutex> lock(mutex); return shared; },
+                [&](const Stats& stats) { std::unique_lock<std::shared_mutex> lock(mutex); shared = stats; });
+
+            std::cout << "[SeqLock] " << readerCount << " readers (M reads/s): SeqLock " << seqLockRate
+                      << ", std::shared_mutex " << sharedMutexRate << std::endl;
+        }
+    }
+}
+
+#endif // THREADS_SEQLOCK_HPP_
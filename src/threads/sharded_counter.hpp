@@ -0,0 +1,200 @@
+#pragma once
+#ifndef THREADS_SHARDED_COUNTER_HPP_
+#define THREADS_SHARDED_COUNTER_HPP_
+
+#include "atomics.hpp"
+#include "cpu_topology.hpp"
+#include "hardware.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Threads
+{
+    enum class ShardPlacement
+    {
+        PerThread,  // Threads get shards round-robin in the order they first touch a counter
+        PerCpu      // The CPU the thread runs on picks the shard, threads sharing a core share it
+    };
+
+    struct ShardedCounterOptions
+    {
+        // Rounded up to a power of two, 0 means one per hardware thread
+        size_t Shards = 0;
+        ShardPlacement Placement = ShardPlacement::PerThread;
+
+        // 0 disables sloppy reads. Otherwise a shard folds into the shared total once it holds
+        // this much, so ReadSloppy() is one load and off by less than Shards * SloppyBatch.
+        int64_t SloppyBatch = 0;
+    };
+
+    // Stable small index for the calling thread, shared by all counters
+    inline size_t ThreadShardIndex()
+    {
+        static std::atomic<size_t> s_nextIndex = 0;
+        static thread_local const size_t t_index = s_nextIndex.fetch_add(1, std::memory_order_relaxed);
+        return t_index;
+    }
+
+    // Counter for hot paths that many threads bump and few read, like request counts. A single
+    // atomic makes every increment fight for one cache line; here each thread (or CPU) adds
+    // to its own padded shard with a relaxed add, and a read sums the shards on demand.
+    //
+    // Increments stay atomic because shards can be shared (more threads than shards, or a
+    // thread migrating between CPUs), but an uncontended relaxed add on a line the core
+    // already owns costs about as much as a plain one.
+    template <typename T = int64_t>
+    class ShardedCounter
+    {
+        static_assert(std::is_integral_v<T>, "ShardedCounter counts integers");
+
+    public:
+        explicit ShardedCounter(ShardedCounterOptions options = { })
+            : m_shardCount(std::bit_ceil(std::max<size_t>(options.Shards ? options.Shards : std::thread::hardware_concurrency(), 1))),
+              m_mask(m_shardCount - 1), m_placement(options.Placement), m_sloppyBatch(static_cast<T>(options.SloppyBatch)),
+              m_shards(std::make_unique<Shard[]>(m_shardCount))
+        {
+        }
+
+        ShardedCounter(const ShardedCounter&) = delete;
+        ShardedCounter& operator=(const ShardedCounter&) = delete;
+
+        void Add(T delta)
+        {
+            std::atomic<T>& shard = m_shards[shardIndex()].Value;
+            if (m_sloppyBatch == 0)
+            {
+                shard.fetch_add(delta, std::memory_order_relaxed);
+                return;
+            }
+
+            T local = shard.fetch_add(delta, std::memory_order_relaxed) + delta;
+            if (local >= m_sloppyBatch || local <= -m_sloppyBatch)
+            {
+                // Whoever takes the shard's value folds it, so nothing is counted twice
+                m_folded.fetch_add(shard.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+        }
+
+        void Increment() { Add(1); }
+
+        // Sum over all shards. Not a snapshot: increments racing with the read may or may
+        // not be included, and with sloppy reads on, a fold in flight may briefly be missed.
+        T Read() const
+        {
+            T total = m_folded.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < m_shardCount; ++i)
+                total += m_shards[i].Value.load(std::memory_order_relaxed);
+            return total;
+        }
+
+        // One load instead of a walk over every shard. Lags Read() by less than
+        // MaxSloppyError(), and equals Read() when sloppy reads are off.
+        T ReadSloppy() const
+        {
+            return m_sloppyBatch == 0 ? Read() : m_folded.load(std::memory_order_relaxed);
+        }
+
+        T MaxSloppyError() const { return m_sloppyBatch == 0 ? 0 : static_cast<T>(m_shardCount) * m_sloppyBatch; }
+
+        size_t ShardCount() const { return m_shardCount; }
+
+    private:
+        struct alignas(CacheLineSize) Shard
+        {
+            std::atomic<T> Value = 0;
+        };
+
+        size_t shardIndex() const
+        {
+            if (m_placement == ShardPlacement::PerCpu)
+            {
+                int cpu = CurrentCpu();
+                if (cpu >= 0)
+                    return static_cast<size_t>(cpu) & m_mask;
+            }
+            return ThreadShardIndex() & m_mask;
+        }
+
+        const size_t m_shardCount;
+        const size_t m_mask;
+        const ShardPlacement m_placement;
+        const T m_sloppyBatch;
+        const std::unique_ptr<Shard[]> m_shards;
+
+        alignas(CacheLineSize) std::atomic<T> m_folded = 0;
+    };
+
+    // Every thread adds the same amount, 1000 increments at a time like Increment() and
+    // MemoryOrderRelaxed() do, so the single-atomic rows run exactly those functions.
+    void BenchmarkShardedCounter(int incrementsPerThread = 2'000'000)
+    {
+        using Clock = std::chrono::steady_clock;
+        const int rounds = incrementsPerThread / 1000;
+
+        auto measure = [rounds](size_t threadCount, auto&& body)
+        {
+            std::vector<std::thread> threads;
+            auto start = Clock::now();
+            for (size_t t = 0; t < threadCount; ++t)
+            {
+                threads.emplace_back([&body, rounds]
+                {
+                    for (int round = 0; round < rounds; ++round)
+                        body();
+                });
+            }
+            for (auto& thread : threads)
+                thread.join();
+
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            return static_cast<double>(threadCount) * rounds * 1000 / seconds / 1e6;
+        };
+
+        size_t maxThreads = std::max<size_t>(std::thread::hardware_concurrency(), 8);
+        for (size_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+        {
+            std::atomic<int> seqCst = 0;
+            std::atomic<int> relaxed = 0;
+            ShardedCounter<int64_t> perThread;
+            ShardedCounter<int64_t> perCpu({ .Placement = ShardPlacement::PerCpu });
+            ShardedCounter<int64_t> sloppy({ .SloppyBatch = 1024 });
+
+            auto sharded = [](ShardedCounter<int64_t>& counter)
+            {
+                return [&counter]
+                {
+                    for (int i = 0; i < 1000; ++i)
+                        counter.Increment();
+                };
+            };
+
+            double seqCstRate = measure(threadCount, [&seqCst] { Increment(seqCst); });
+            double relaxedRate = measure(threadCount, [&relaxed] { MemoryOrderRelaxed(relaxed); });
+            double perThreadRate = measure(threadCount, sharded(perThread));
+            double perCpuRate = measure(threadCount, sharded(perCpu));
+            double sloppyRate = measure(threadCount, sharded(sloppy));
+
+            const int64_t expected = static_cast<int64_t>(threadCount) * rounds * 1000;
+            if (perThread.Read() != expected || perCpu.Read() != expected || sloppy.Read() != expected)
+                std::cout << "[Counter] count mismatch" << std::endl;
+            if (expected - sloppy.ReadSloppy() >= sloppy.MaxSloppyError())
+                std::cout << "[Counter] sloppy read off by more than its bound" << std::endl;
+
+            std::cout << "[Counter] " << threadCount << " threads (M increments/s): atomic++ " << seqCstRate
+                      << ", relaxed fetch_add " << relaxedRate << ", sharded per thread " << perThreadRate
+                      << ", sharded per CPU " << perCpuRate << ", sloppy " << sloppyRate << std::endl;
+        }
+    }
+}
+
+#endif // THREADS_SHARDED_COUNTER_HPP_
@@ -0,0 +1,434 @@
+#pragma once
+#ifndef THREADS_SIMD_REDUCE_HPP_
+#define THREADS_SIMD_REDUCE_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+// Runtime dispatch needs __builtin_cpu_supports and the target attribute, which
+// GCC and Clang have. Everything else gets the portable kernels, which the
+// compiler still vectorizes for the baseline instruction set.
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+    #define THREADS_SIMD_X86_DISPATCH 1
+    #include <immintrin.h>
+#else
+    #define THREADS_SIMD_X86_DISPATCH 0
+#endif
+
+namespace Threads::Simd
+{
+    // The type a sum of T is accumulated in: 32-bit values are widened, so that
+    // summing a few billion ints can't overflow and floats don't lose the small
+    // addends once the running total got large
+    template <typename T>
+    struct SumTraits { using Type = T; };
+
+    template <> struct SumTraits<int32_t> { using Type = int64_t; };
+    template <> struct SumTraits<float> { using Type = double; };
+
+    template <typename T>
+    using SumType = typename SumTraits<T>::Type;
+
+    // Kernels with one plain loop and four independent accumulators: the adds of one
+    // iteration don't wait for each other, which hides the latency of the add unit
+    namespace Portable
+    {
+        template <typename T>
+        SumType<T> Sum(const T* data, size_t count)
+        {
+            SumType<T> acc[4] = { };
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                acc[0] += static_cast<SumType<T>>(data[i]);
+                acc[1] += static_cast<SumType<T>>(data[i + 1]);
+                acc[2] += static_cast<SumType<T>>(data[i + 2]);
+                acc[3] += static_cast<SumType<T>>(data[i + 3]);
+            }
+            for (; i < count; ++i)
+                acc[0] += static_cast<SumType<T>>(data[i]);
+            return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+        }
+    }
+
+#if THREADS_SIMD_X86_DISPATCH
+    // Every kernel keeps four vector accumulators, so one iteration covers four
+    // registers worth of input: 256 bytes per iteration with AVX-512, 128 with AVX2.
+    // Loads are unaligned, which costs nothing on data that happens to be aligned.
+    namespace Sse2
+    {
+        __attribute__((target("sse2"))) inline int64_t SumInt32(const int32_t* data, size_t count)
+        {
+            __m128i acc[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                // SSE2 has no sign extension, so interleave every value with its sign mask
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 4));
+                __m128i signA = _mm_srai_epi32(a, 31);
+                __m128i signB = _mm_srai_epi32(b, 31);
+                acc[0] = _mm_add_epi64(acc[0], _mm_unpacklo_epi32(a, signA));
+                acc[1] = _mm_add_epi64(acc[1], _mm_unpackhi_epi32(a, signA));
+                acc[2] = _mm_add_epi64(acc[2], _mm_unpacklo_epi32(b, signB));
+                acc[3] = _mm_add_epi64(acc[3], _mm_unpackhi_epi32(b, signB));
+            }
+
+            __m128i total = _mm_add_epi64(_mm_add_epi64(acc[0], acc[1]), _mm_add_epi64(acc[2], acc[3]));
+            alignas(16) int64_t lanes[2];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), total);
+            return lanes[0] + lanes[1] + Portable::Sum(data + i, count - i);
+        }
+
+        __attribute__((target("sse2"))) inline int64_t SumInt64(const int64_t* data, size_t count)
+        {
+            __m128i acc[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                for (size_t k = 0; k < 4; ++k)
+                    acc[k] = _mm_add_epi64(acc[k], _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2 * k)));
+            }
+
+            __m128i total = _mm_add_epi64(_mm_add_epi64(acc[0], acc[1]), _mm_add_epi64(acc[2], acc[3]));
+            alignas(16) int64_t lanes[2];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), total);
+            return lanes[0] + lanes[1] + Portable::Sum(data + i, count - i);
+        }
+
+        __attribute__((target("sse2"))) inline double SumFloat(const float* data, size_t count)
+        {
+            __m128d acc[4] = { _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd() };
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                __m128 a = _mm_loadu_ps(data + i);
+                __m128 b = _mm_loadu_ps(data + i + 4);
+                acc[0] = _mm_add_pd(acc[0], _mm_cvtps_pd(a));
+                acc[1] = _mm_add_pd(acc[1], _mm_cvtps_pd(_mm_movehl_ps(a, a)));
+                acc[2] = _mm_add_pd(acc[2], _mm_cvtps_pd(b));
+                acc[3] = _mm_add_pd(acc[3], _mm_cvtps_pd(_mm_movehl_ps(b, b)));
+            }
+
+            __m128d total = _mm_add_pd(_mm_add_pd(acc[0], acc[1]), _mm_add_pd(acc[2], acc[3]));
+            alignas(16) double lanes[2];
+            _mm_store_pd(lanes, total);
+            return lanes[0] + lanes[1] + Portable::Sum(data + i, count - i);
+        }
+
+        __attribute__((target("sse2"))) inline double SumDouble(const double* data, size_t count)
+        {
+            __m128d acc[4] = { _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd() };
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                for (size_t k = 0; k < 4; ++k)
+                    acc[k] = _mm_add_pd(acc[k], _mm_loadu_pd(data + i + 2 * k));
+            }
+
+            __m128d total = _mm_add_pd(_mm_add_pd(acc[0], acc[1]), _mm_add_pd(acc[2], acc[3]));
+            alignas(16) double lanes[2];
+            _mm_store_pd(lanes, total);
+            return lanes[0] + lanes[1] + Portable::Sum(data + i, count - i);
+        }
+    }
+
+    namespace Avx2
+    {
+        __attribute__((target("avx2"))) inline int64_t HorizontalSum(__m256i v)
+        {
+            __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+        }
+
+        __attribute__((target("avx2"))) inline double HorizontalSum(__m256d v)
+        {
+            __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+            return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+        }
+
+        __attribute__((target("avx2"))) inline int64_t SumInt32(const int32_t* data, size_t count)
+        {
+            __m256i acc[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+            size_t i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                for (size_t k = 0; k < 4; ++k)
+                {
+                    __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 4 * k));
+                    acc[k] = _mm256_add_epi64(acc[k], _mm256_cvtepi32_epi64(values));
+                }
+            }
+
+            __m256i total = _mm256_add_epi64(_mm256_add_epi64(acc[0], acc[1]), _mm256_add_epi64(acc[2], acc[3]));
+            return HorizontalSum(total) + Portable::Sum(data + i, count - i);
+        }
+
+        __attribute__((target("avx2"))) inline int64_t SumInt64(const int64_t* data, size_t count)
+        {
+            __m256i acc[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+            size_t i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                for (size_t k = 0; k < 4; ++k)
+                    acc[k] = _mm256_add_epi64(acc[k], _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 4 * k)));
+            }
+
+            __m256i total = _mm256_add_epi64(_mm256_add_epi64(acc[0], acc[1]), _mm256_add_epi64(acc[2], acc[3]));
+            return HorizontalSum(total) + Portable::Sum(data + i, count - i);
+        }
+
+        __attribute__((target("avx2"))) inline double SumFloat(const float* data, size_t count)
+        {
+            __m256d acc[4] = { _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd() };
+            size_t i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                for (size_t k = 0; k < 4; ++k)
+                    acc[k] = _mm256_add_pd(acc[k], _mm256_cvtps_pd(_mm_loadu_ps(data + i + 4 * k)));
+            }
+
+            __m256d total = _mm256_add_pd(_mm256_add_pd(acc[0], acc[1]), _mm256_add_pd(acc[2], acc[3]));
+            return HorizontalSum(total) + Portable::Sum(data + i, count - i);
+        }
+
+        __attribute__((target("avx2"))) inline double SumDouble(const double* data, size_t count)
+        {
+            __m256d acc[4] = { _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd() };
+            size_t i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                for (size_t k = 0; k < 4; ++k)
+                    acc[k] = _mm256_add_pd(acc[k], _mm256_loadu_pd(data + i + 4 * k));
+            }
+
+            __m256d total = _mm256_add_pd(_mm256_add_pd(acc[0], acc[1]), _mm256_add_pd(acc[2], acc[3]));
+            return HorizontalSum(total) + Portable::Sum(data + i, count - i);
+        }
+    }
+
+    // GCC 12's AVX-512 headers trip over their own _mm512_undefined_* helpers
+    // (fixed in GCC 13), silence that instead of every caller's build log
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wuninitialized"
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+    namespace Avx512
+    {
+        __attribute__((target("avx512f"))) inline int64_t SumInt32(const int32_t* data, size_t count)
+        {
+            __m512i acc[4] = { _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512() };
+            size_t i = 0;
+            for (; i + 32 <= count; i += 32)
+            {
+                for (size_t k = 0; k < 4; ++k)
+                {
+                    __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 8 * k));
+                    acc[k] = _mm512_add_epi64(acc[k], _mm512_cvtepi32_epi64(values));
+                }
+            }
+
+            __m512i total = _mm512_add_epi64(_mm512_add_epi64(acc[0], acc[1]), _mm512_add_epi64(acc[2], acc[3]));
+            return _mm512_reduce_add_epi64(total) + Portable::Sum(data + i, count - i);
+        }
+
+        __attribute__((target("avx512f"))) inline int64_t SumInt64(const int64_t* data, size_t count)
+        {
+            __m512i acc[4] = { _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512() };
+            size_t i = 0;
+            for (; i + 32 <= count; i += 32)
+            {
+                for (size_t k = 0; k < 4; ++k)
+                    acc[k] = _mm512_add_epi64(acc[k], _mm512_loadu_si512(data + i + 8 * k));
+            }
+
+            __m512i total = _mm512_add_epi64(_mm512_add_epi64(acc[0], acc[1]), _mm512_add_epi64(acc[2], acc[3]));
+            return _mm512_reduce_add_epi64(total) + Portable::Sum(data + i, count - i);
+        }
+
+        __attribute__((target("avx512f"))) inline double SumFloat(const float* data, size_t count)
+        {
+            __m512d acc[4] = { _mm512_setzero_pd(), _mm512_setzero_pd(), _mm512_setzero_pd(), _mm512_setzero_pd() };
+            size_t i = 0;
+            for (; i + 32 <= count; i += 32)
+            {
+                for (size_t k = 0; k < 4; ++k)
+                    acc[k] = _mm512_add_pd(acc[k], _mm512_cvtps_pd(_mm256_loadu_ps(data + i + 8 * k)));
+            }
+
+            __m512d total = _mm512_add_pd(_mm512_add_pd(acc[0], acc[1]), _mm512_add_pd(acc[2], acc[3]));
+            return _mm512_reduce_add_pd(total) + Portable::Sum(data + i, count - i);
+        }
+
+        __attribute__((target("avx512f"))) inline double SumDouble(const double* data, size_t count)
+        {
+            __m512d acc[4] = { _mm512_setzero_pd(), _mm512_setzero_pd(), _mm512_setzero_pd(), _mm512_setzero_pd() };
+            size_t i = 0;
+            for (; i + 32 <= count; i += 32)
+            {
+                for (size_t k = 0; k < 4; ++k)
+                    acc[k] = _mm512_add_pd(acc[k], _mm512_loadu_pd(data + i + 8 * k));
+            }
+
+            __m512d total = _mm512_add_pd(_mm512_add_pd(acc[0], acc[1]), _mm512_add_pd(acc[2], acc[3]));
+            return _mm512_reduce_add_pd(total) + Portable::Sum(data + i, count - i);
+        }
+    }
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic pop
+#endif
+#endif
+
+    enum class InstructionSet
+    {
+        Portable,
+        Sse2,
+        Avx2,
+        Avx512
+    };
+
+    // The widest instruction set both the CPU and this build support, detected once
+    inline InstructionSet DetectedInstructionSet()
+    {
+#if THREADS_SIMD_X86_DISPATCH
+        static const InstructionSet detected = []
+        {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+                return InstructionSet::Avx512;
+            if (__builtin_cpu_supports("avx2"))
+                return InstructionSet::Avx2;
+            if (__builtin_cpu_supports("sse2"))
+                return InstructionSet::Sse2;
+            return InstructionSet::Portable;
+        }();
+        return detected;
+#else
+        return InstructionSet::Portable;
+#endif
+    }
+
+    inline const char* ToString(InstructionSet set)
+    {
+        switch (set)
+        {
+        case InstructionSet::Sse2: return "SSE2";
+        case InstructionSet::Avx2: return "AVX2";
+        case InstructionSet::Avx512: return "AVX-512";
+        default: return "portable";
+        }
+    }
+
+    // The kernel for T picked from the table below, resolved into a function pointer on
+    // first use so that the hot call is one indirect jump without any feature checks
+    template <typename T>
+    using SumKernel = SumType<T> (*)(const T*, size_t);
+
+    template <typename T>
+    SumKernel<T> SelectSumKernel(InstructionSet set)
+    {
+#if THREADS_SIMD_X86_DISPATCH
+        struct Kernels { SumKernel<T> Sse2, Avx2, Avx512; };
+        Kernels kernels;
+        if constexpr (std::is_same_v<T, int32_t>)
+            kernels = { Sse2::SumInt32, Avx2::SumInt32, Avx512::SumInt32 };
+        else if constexpr (std::is_same_v<T, int64_t>)
+            kernels = { Sse2::SumInt64, Avx2::SumInt64, Avx512::SumInt64 };
+        else if constexpr (std::is_same_v<T, float>)
+            kernels = { Sse2::SumFloat, Avx2::SumFloat, Avx512::SumFloat };
+        else
+            kernels = { Sse2::SumDouble, Avx2::SumDouble, Avx512::SumDouble };
+
+        switch (set)
+        {
+        case InstructionSet::Avx512: return kernels.Avx512;
+        case InstructionSet::Avx2: return kernels.Avx2;
+        case InstructionSet::Sse2: return kernels.Sse2;
+        default: break;
+        }
+#else
+        (void)set;
+#endif
+        return Portable::Sum<T>;
+    }
+
+    template <typename T>
+    concept Vectorizable = std::is_same_v<T, int32_t> || std::is_same_v<T, int64_t>
+                        || std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+    // Sum of count values in the widened SumType<T>. Floating-point sums are reassociated,
+    // so the result may differ from a left-to-right std::accumulate in the last bits.
+    template <Vectorizable T>
+    SumType<T> Sum(const T* data, size_t count)
+    {
+        static const SumKernel<T> kernel = SelectSumKernel<T>(DetectedInstructionSet());
+        return kernel(data, count);
+    }
+
+    // Any range: contiguous ranges of the four kernel types go to the vector kernels,
+    // everything else is accumulated in the widened type by a plain loop
+    template <std::input_iterator It>
+    SumType<std::iter_value_t<It>> Sum(It first, It last)
+    {
+        using T = std::iter_value_t<It>;
+        if constexpr (std::contiguous_iterator<It> && Vectorizable<T>)
+            return Sum(std::to_address(first), static_cast<size_t>(last - first));
+        else
+            return std::accumulate(first, last, SumType<T>());
+    }
+
+    // Throughput of std::accumulate against the dispatched kernel, once on a buffer that
+    // fits into L2 and once on one that has to stream from memory. On the big buffer a
+    // single core is already close to the memory bandwidth it can pull.
+    void BenchmarkSimdReduce()
+    {
+        using Clock = std::chrono::steady_clock;
+
+        std::cout << "[SIMD] Dispatching to " << ToString(DetectedInstructionSet()) << std::endl;
+
+        auto run = [](const char* type, auto sample, size_t count, size_t repeats)
+        {
+            using T = decltype(sample);
+            std::vector<T> values(count, sample);
+
+            auto gbPerSecond = [&](Clock::duration elapsed)
+            {
+                return static_cast<double>(count * sizeof(T) * repeats) / std::chrono::duration<double>(elapsed).count() / 1e9;
+            };
+
+            SumType<T> scalar = 0;
+            auto start = Clock::now();
+            for (size_t r = 0; r < repeats; ++r)
+                scalar += std::accumulate(values.begin(), values.end(), SumType<T>());
+            auto scalarTime = Clock::now() - start;
+
+            SumType<T> simd = 0;
+            start = Clock::now();
+            for (size_t r = 0; r < repeats; ++r)
+                simd += Sum(values.data(), values.size());
+            auto simdTime = Clock::now() - start;
+
+            std::cout << "[SIMD] " << type << " x " << count << ": std::accumulate " << gbPerSecond(scalarTime)
+                      << " GB/s, kernel " << gbPerSecond(simdTime) << " GB/s"
+                      << (scalar == simd ? "" : " (results differ in rounding)") << std::endl;
+        };
+
+        for (auto [count, repeats] : { std::pair<size_t, size_t> { 16 * 1024, 10'000 }, { 64 * 1024 * 1024, 5 } })
+        {
+            run("int32", int32_t(1), count, repeats);
+            run("int64", int64_t(1), count, repeats);
+            run("float", 1.0f, count, repeats);
+            run("double", 1.0, count, repeats);
+        }
+    }
+}
+
+#endif // THREADS_SIMD_REDUCE_HPP_
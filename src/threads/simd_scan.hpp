@@ -0,0 +1,157 @@
+#pragma once
+#ifndef THREADS_SIMD_SCAN_HPP_
+#define THREADS_SIMD_SCAN_HPP_
+
+#include "simd_reduce.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+
+namespace Threads::Simd
+{
+    // Writes the offset of every '\n' in data[0, size) to positions and returns how many
+    // there were. size must fit into 32 bits and positions must have room for size entries.
+    using NewlineKernel = size_t (*)(const char* data, size_t size, uint32_t* positions);
+
+    namespace Portable
+    {
+        // memchr is vectorized by the C library already, but it is one call per line
+        inline size_t FindNewlines(const char* data, size_t size, uint32_t* positions)
+        {
+            size_t count = 0;
+            const char* end = data + size;
+            for (const char* p = data; p < end;)
+            {
+                const char* newline = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+                if (!newline)
+                    break;
+                positions[count++] = static_cast<uint32_t>(newline - data);
+                p = newline + 1;
+            }
+            return count;
+        }
+    }
+
+#if THREADS_SIMD_X86_DISPATCH
+    // Compare 64 bytes against '\n' at a time and turn the matches into a bit mask, then
+    // peel the set bits off one by one. Short lines cost a few instructions each instead
+    // of a memchr call.
+    namespace Sse2
+    {
+        __attribute__((target("sse2"))) inline size_t FindNewlines(const char* data, size_t size, uint32_t* positions)
+        {
+            const __m128i newline = _mm_set1_epi8('\n');
+            size_t count = 0;
+            size_t i = 0;
+            for (; i + 64 <= size; i += 64)
+            {
+                uint64_t mask = 0;
+                for (size_t k = 0; k < 4; ++k)
+                {
+                    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16 * k));
+                    mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)))) << (16 * k);
+                }
+                for (; mask; mask &= mask - 1)
+                    positions[count++] = static_cast<uint32_t>(i + static_cast<size_t>(std::countr_zero(mask)));
+            }
+
+            size_t tail = Portable::FindNewlines(data + i, size - i, positions + count);
+            for (size_t k = count; k < count + tail; ++k)
+                positions[k] += static_cast<uint32_t>(i);
+            return count + tail;
+        }
+    }
+
+    namespace Avx2
+    {
+        __attribute__((target("avx2"))) inline size_t FindNewlines(const char* data, size_t size, uint32_t* positions)
+        {
+            const __m256i newline = _mm256_set1_epi8('\n');
+            size_t count = 0;
+            size_t i = 0;
+            for (; i + 64 <= size; i += 64)
+            {
+                __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+                uint64_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newline)))
+                              | static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newline)))) << 32;
+                for (; mask; mask &= mask - 1)
+                    positions[count++] = static_cast<uint32_t>(i + static_cast<size_t>(std::countr_zero(mask)));
+            }
+
+            size_t tail = Portable::FindNewlines(data + i, size - i, positions + count);
+            for (size_t k = count; k < count + tail; ++k)
+                positions[k] += static_cast<uint32_t>(i);
+            return count + tail;
+        }
+    }
+#endif
+
+    // The instruction set of the newline kernel that runs on a CPU supporting set.
+    // AVX-512 brings nothing here over AVX2: the loop is bound by peeling bits off the mask.
+    inline InstructionSet NewlineKernelSet(InstructionSet set)
+    {
+#if THREADS_SIMD_X86_DISPATCH
+        return set == InstructionSet::Avx512 ? InstructionSet::Avx2 : set;
+#else
+        (void)set;
+        return InstructionSet::Portable;
+#endif
+    }
+
+    inline NewlineKernel SelectNewlineKernel(InstructionSet set)
+    {
+#if THREADS_SIMD_X86_DISPATCH
+        switch (NewlineKernelSet(set))
+        {
+        case InstructionSet::Avx2: return Avx2::FindNewlines;
+        case InstructionSet::Sse2: return Sse2::FindNewlines;
+        default: break;
+        }
+#else
+        (void)set;
+#endif
+        return Portable::FindNewlines;
+    }
+
+    // Finds the newlines of a buffer one chunk at a time, so the offset table stays small
+    // enough for L2 however large the buffer is
+    class NewlineScanner
+    {
+    public:
+        static constexpr size_t ChunkSize = 16 * 1024;
+
+        explicit NewlineScanner(InstructionSet set = DetectedInstructionSet())
+            : m_kernel(SelectNewlineKernel(set)), m_positions(std::make_unique<uint32_t[]>(ChunkSize))
+        {
+        }
+
+        // Offsets of the newlines in data[0, size), size at most ChunkSize
+        std::span<const uint32_t> Scan(const char* data, size_t size)
+        {
+            return { m_positions.get(), m_kernel(data, size, m_positions.get()) };
+        }
+
+        // Calls onNewline(offset) for every '\n' in data[0, size), in order
+        template <typename F>
+        void ForEach(const char* data, size_t size, F&& onNewline)
+        {
+            for (size_t chunk = 0; chunk < size; chunk += ChunkSize)
+            {
+                for (uint32_t offset : Scan(data + chunk, std::min(ChunkSize, size - chunk)))
+                    onNewline(chunk + offset);
+            }
+        }
+
+    private:
+        NewlineKernel m_kernel;
+        std::unique_ptr<uint32_t[]> m_positions;
+    };
+}
+
+#endif // THREADS_SIMD_SCAN_HPP_
@@ -0,0 +1,319 @@
+#pragma once
+#ifndef THREADS_SPINLOCKS_HPP_
+#define THREADS_SPINLOCKS_HPP_
+
+#include "hardware.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Threads
+{
+    // Exponential backoff for spin-wait loops: 1, 2, 4, ... PAUSEs per round, then yields once
+    // the rounds get long. Spinning only pays off while the holder is running; yielding
+    // keeps a descheduled holder (or one sharing our core) from waiting out our time slice.
+    class Backoff
+    {
+    public:
+        void Pause()
+        {
+            if (m_round < MaxRound)
+            {
+                for (uint32_t i = 0; i < (1u << m_round); ++i)
+                    CpuRelax();
+                ++m_round;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        void Reset() { m_round = 0; }
+
+    private:
+        // Up to 2^7 - 1 PAUSEs in total, a few microseconds on current CPUs
+        static constexpr uint32_t MaxRound = 7;
+        uint32_t m_round = 0;
+    };
+
+    // The spinlock of Threads::Acquire(): test_and_set in a tight loop. Every iteration is
+    // a write, so waiters keep stealing the line from each other and from the holder.
+    // Kept as the baseline of the lock shootout.
+    class NaiveSpinLock
+    {
+    public:
+        void lock()
+        {
+            while (m_flag.test_and_set(std::memory_order_acquire)) { }
+        }
+
+        bool try_lock() { return !m_flag.test_and_set(std::memory_order_acquire); }
+        void unlock() { m_flag.clear(std::memory_order_release); }
+
+    private:
+        std::atomic_flag m_flag = ATOMIC_FLAG_INIT;
+    };
+
+    // Test-and-test-and-set: waiters spin on a plain load, which hits their own cached
+    // copy of the line, and only try the exchange once the lock looks free. Backoff spreads
+    // out the stampede when it is released. Not fair, a thread that just unlocked often
+    // takes the lock again.
+    class TtasSpinLock
+    {
+    public:
+        void lock()
+        {
+            Backoff backoff;
+            while (m_locked.exchange(true, std::memory_order_acquire))
+            {
+                while (m_locked.load(std::memory_order_relaxed))
+                    backoff.Pause();
+            }
+        }
+
+        bool try_lock()
+        {
+            return !m_locked.load(std::memory_order_relaxed) && !m_locked.exchange(true, std::memory_order_acquire);
+        }
+
+        void unlock() { m_locked.store(false, std::memory_order_release); }
+
+    private:
+        alignas(CacheLineSize) std::atomic<bool> m_locked = false;
+    };
+
+    // Fair FIFO lock: lock() draws a ticket and waits until it is served. Waiters back off in
+    // proportion to how many tickets are ahead of them. All waiters still poll the same
+    // line, so every unlock invalidates it in every waiter's cache.
+    class TicketLock
+    {
+    public:
+        void lock()
+        {
+            const uint32_t ticket = m_next.fetch_add(1, std::memory_order_relaxed);
+            uint32_t serving = m_serving.load(std::memory_order_acquire);
+            uint32_t spins = 0;
+            while (serving != ticket)
+            {
+                // A waiter far down the queue has nothing to gain from polling often
+                for (uint32_t i = 0; i < (ticket - serving) * BackoffPerWaiter; ++i)
+                    CpuRelax();
+
+                // The holder or a waiter ahead of us may not be running at all
+                if (++spins > YieldAfter)
+                    std::this_thread::yield();
+
+                serving = m_serving.load(std::memory_order_acquire);
+            }
+        }
+
+        bool try_lock()
+        {
+            // Acquire pairs with unlock(): the previous holder released through m_serving
+            uint32_t serving = m_serving.load(std::memory_order_acquire);
+            uint32_t expected = serving;
+            return m_next.compare_exchange_strong(expected, serving + 1, std::memory_order_relaxed);
+        }
+
+        // Only the holder writes m_serving, so this needs no read-modify-write
+        void unlock()
+        {
+            m_serving.store(m_serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        static constexpr uint32_t BackoffPerWaiter = 32;
+        static constexpr uint32_t YieldAfter = 16;
+
+        // Kept together: try_lock() needs to see both
+        alignas(CacheLineSize) std::atomic<uint32_t> m_next = 0;
+        std::atomic<uint32_t> m_serving = 0;
+    };
+
+    // MCS queue lock. Each waiter enqueues its own node and spins on a flag in that node,
+    // so a waiter only ever polls its own cache line and an unlock touches exactly one
+    // waiter's line: the handoff costs the same at 2 threads and at 64. FIFO like the
+    // ticket lock.
+    //
+    // lock() and unlock() take no arguments so that the lock works with std::lock_guard and
+    // std::scoped_lock. The queue nodes come from a small per-thread pool and the holder
+    // remembers its node in the lock, which only the holder reads.
+    class McsLock
+    {
+    public:
+        McsLock() = default;
+        McsLock(const McsLock&) = delete;
+        McsLock& operator=(const McsLock&) = delete;
+
+        void lock()
+        {
+            Node* node = acquireNode();
+            Node* predecessor = m_tail.exchange(node, std::memory_order_acq_rel);
+            if (predecessor)
+            {
+                predecessor->Next.store(node, std::memory_order_release);
+
+                Backoff backoff;
+                while (node->Locked.load(std::memory_order_acquire))
+                    backoff.Pause();
+            }
+            m_holder = node;
+        }
+
+        bool try_lock()
+        {
+            Node* node = acquireNode();
+            Node* expected = nullptr;
+            if (!m_tail.compare_exchange_strong(expected, node, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                releaseNode(node);
+                return false;
+            }
+            m_holder = node;
+            return true;
+        }
+
+        void unlock()
+        {
+            Node* node = m_holder;
+            Node* successor = node->Next.load(std::memory_order_acquire);
+            if (!successor)
+            {
+                // Nobody behind us, unless a thread is between its exchange and linking in
+                Node* expected = node;
+                if (m_tail.compare_exchange_strong(expected, nullptr, std::memory_order_release, std::memory_order_relaxed))
+                {
+                    releaseNode(node);
+                    return;
+                }
+
+                Backoff backoff;
+                while (!(successor = node->Next.load(std::memory_order_acquire)))
+                    backoff.Pause();
+            }
+
+            successor->Locked.store(false, std::memory_order_release);
+            releaseNode(node);
+        }
+
+    private:
+        struct alignas(CacheLineSize) Node
+        {
+            std::atomic<Node*> Next = nullptr;
+            std::atomic<bool> Locked = true;
+        };
+
+        // Nodes a thread isn't queued with, one per lock it holds at a time. Nodes are only
+        // referenced by other threads between lock() and the end of unlock(), so the pool
+        // can go away with its thread.
+        struct NodePool
+        {
+            std::vector<std::unique_ptr<Node>> Nodes;
+            std::vector<Node*> Free;
+        };
+
+        static Node* acquireNode()
+        {
+            NodePool& pool = t_pool;
+            if (pool.Free.empty())
+            {
+                pool.Nodes.push_back(std::make_unique<Node>());
+                pool.Free.push_back(pool.Nodes.back().get());
+            }
+
+            Node* node = pool.Free.back();
+            pool.Free.pop_back();
+            node->Next.store(nullptr, std::memory_order_relaxed);
+            node->Locked.store(true, std::memory_order_relaxed);
+            return node;
+        }
+
+        static void releaseNode(Node* node) { t_pool.Free.push_back(node); }
+
+        static inline thread_local NodePool t_pool;
+
+        alignas(CacheLineSize) std::atomic<Node*> m_tail = nullptr;
+        // Written and read by the holder only
+        Node* m_holder = nullptr;
+    };
+
+    // Threads take the lock in a loop, do some work inside and a fixed amount outside.
+    // The critical-section length is in iterations of a dependent arithmetic loop (~1 ns
+    // each). Total work is split over the threads, so rows are comparable per thread count.
+    // With more threads than cores the FIFO locks fall apart: the next thread in line may
+    // be descheduled, and nobody else is allowed to take the lock meanwhile.
+    void BenchmarkLockShootout(int acquisitions = 400'000)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        auto spin = [](uint64_t& state, int iterations)
+        {
+            for (int i = 0; i < iterations; ++i)
+                state = state * 6364136223846793005ull + 1442695040888963407ull;
+        };
+
+        auto run = [&](auto& mutex, size_t threadCount, int inside)
+        {
+            uint64_t shared = 0;
+            const int perThread = acquisitions / static_cast<int>(threadCount);
+
+            std::vector<std::thread> threads;
+            auto start = Clock::now();
+            for (size_t t = 0; t < threadCount; ++t)
+            {
+                threads.emplace_back([&, t]
+                {
+                    uint64_t local = t + 1;
+                    for (int i = 0; i < perThread; ++i)
+                    {
+                        {
+                            std::scoped_lock lock(mutex);
+                            spin(shared, inside);
+                            ++shared;
+                        }
+                        spin(local, 50);
+                    }
+                    // Keeps the work outside the lock from being optimized away
+                    if (local == 0)
+                        std::cout << "";
+                });
+            }
+            for (auto& thread : threads)
+                thread.join();
+
+            double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+            return ns / (perThread * threadCount);
+        };
+
+        size_t maxThreads = std::max<size_t>(std::thread::hardware_concurrency(), 8);
+        for (int inside : { 0, 50, 500 })
+        {
+            for (size_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+            {
+                std::mutex stdMutex;
+                NaiveSpinLock naive;
+                TtasSpinLock ttas;
+                TicketLock ticket;
+                McsLock mcs;
+
+                std::cout << "[Locks] critical section " << inside << ", " << threadCount << " threads (ns/acquisition): "
+                          << "std::mutex " << run(stdMutex, threadCount, inside)
+                          << ", naive " << run(naive, threadCount, inside)
+                          << ", TTAS " << run(ttas, threadCount, inside)
+                          << ", ticket " << run(ticket, threadCount, inside)
+                          << ", MCS " << run(mcs, threadCount, inside) << std::endl;
+            }
+        }
+    }
+}
+
+#endif // THREADS_SPINLOCKS_HPP_
@@ -0,0 +1,298 @@
+#pragma once
+#ifndef THREADS_SPSC_CHANNEL_HPP_
+#define THREADS_SPSC_CHANNEL_HPP_
+
+#include "coroutines.hpp"
+#include "hardware.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace Threads
+{
+    // Wait-free ring for exactly one producer thread and one consumer thread, the shape of
+    // most pipeline stages. Each index has a single writer, so there is no CAS anywhere:
+    // the producer only stores the tail, the consumer only stores the head.
+    //
+    // Each side also keeps a private copy of the other side's index and only reloads the
+    // shared one when the copy says the ring is full (or empty). In steady state a push
+    // touches the producer's own cache line and the slot, nothing the consumer is writing.
+    //
+    // Slots hold constructed T objects that are reused lap after lap. Reserve()/Commit()
+    // and Peek()/Release() work on them in place, so a message with a string keeps its
+    // buffer and a steady stream of messages allocates nothing.
+    template <typename T>
+    class SpscChannel
+    {
+        static_assert(std::is_default_constructible_v<T>, "Slots are constructed up front and reused");
+
+    public:
+        // Rounded up to a power of two, at least 2
+        explicit SpscChannel(size_t capacity)
+            : m_capacity(std::bit_ceil(std::max<size_t>(capacity, 2))), m_mask(m_capacity - 1),
+              m_slots(std::make_unique<T[]>(m_capacity))
+        {
+        }
+
+        SpscChannel(const SpscChannel&) = delete;
+        SpscChannel& operator=(const SpscChannel&) = delete;
+
+        size_t Capacity() const { return m_capacity; }
+
+        // Approximate when called from a third thread, but always within [0, capacity].
+        // Head first: the consumer only moved it past positions it had seen the tail pass,
+        // so the tail loaded afterwards can't be behind it. Both may move on in between,
+        // the tail further than a lap ahead of the head we saw, hence the clamp.
+        size_t Size() const
+        {
+            const size_t head = m_head.load(std::memory_order_acquire);
+            const size_t tail = m_tail.load(std::memory_order_acquire);
+            return std::min(tail - head, m_capacity);
+        }
+
+        bool Empty() const { return Size() == 0; }
+
+        // Producer side ////////////////////////////////////////////////////////////////////
+
+        // Slot to write the next message into, or nullptr when the ring is full. The
+        // message becomes visible with Commit(); until then Reserve() returns the same slot.
+        T* Reserve()
+        {
+            const size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_cachedHead == m_capacity)
+            {
+                m_cachedHead = m_head.load(std::memory_order_acquire);
+                if (tail - m_cachedHead == m_capacity)
+                    return nullptr;
+            }
+            return &m_slots[tail & m_mask];
+        }
+
+        // Publishes the slot returned by the last Reserve()
+        void Commit()
+        {
+            m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        template <typename U>
+        bool TryPush(U&& value)
+        {
+            T* slot = Reserve();
+            if (!slot)
+                return false;
+
+            *slot = std::forward<U>(value);
+            Commit();
+            return true;
+        }
+
+        // Consumer side ////////////////////////////////////////////////////////////////////
+
+        // Oldest message, or nullptr when the ring is empty. It stays valid and in place
+        // until Release().
+        T* Peek()
+        {
+            const size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_cachedTail)
+            {
+                m_cachedTail = m_tail.load(std::memory_order_acquire);
+                if (head == m_cachedTail)
+                    return nullptr;
+            }
+            return &m_slots[head & m_mask];
+        }
+
+        // Hands the slot returned by the last Peek() back to the producer
+        void Release()
+        {
+            m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        bool TryPop(T& out)
+        {
+            T* slot = Peek();
+            if (!slot)
+                return false;
+
+            // Moved-from, the slot keeps whatever capacity the move leaves behind
+            out = std::move(*slot);
+            Release();
+            return true;
+        }
+
+        std::optional<T> TryPop()
+        {
+            std::optional<T> result;
+            if (T* slot = Peek())
+            {
+                result.emplace(std::move(*slot));
+                Release();
+            }
+            return result;
+        }
+
+    private:
+        const size_t m_capacity;
+        const size_t m_mask;
+        const std::unique_ptr<T[]> m_slots;
+
+        // Written by the producer only
+        alignas(CacheLineSize) std::atomic<size_t> m_tail = 0;
+        size_t m_cachedHead = 0;
+
+        // Written by the consumer only
+        alignas(CacheLineSize) std::atomic<size_t> m_head = 0;
+        size_t m_cachedTail = 0;
+    };
+
+    // The EventQueue from the coroutine examples takes its mutex on every push and pop.
+    // Its pool only resumes a waiting handler, and the comparison never has one.
+    struct LockedEventQueue
+    {
+        ThreadPool Pool { 1 };
+        EventQueue Queue { Pool };
+
+        bool TryPush(const Event& event)
+        {
+            Queue.push(event);
+            return true;
+        }
+
+        bool TryPop(Event& out)
+        {
+            std::optional<Event> event = Queue.try_pop();
+            if (!event)
+                return false;
+            out = std::move(*event);
+            return true;
+        }
+    };
+
+    // Throughput: one producer streams messages to one consumer.
+    // Latency: one message ping-pongs between two threads, a one-way hop is half a round trip.
+    void BenchmarkSpscChannel(int messages = 2'000'000, int roundTrips = 100'000, size_t capacity = 1024)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        // Spin a little, then give the other side the core in case we share one
+        auto backoff = [](int& misses)
+        {
+            if (++misses < 64)
+                CpuRelax();
+            else
+                std::this_thread::yield();
+        };
+
+        auto throughput = [&](auto& queue, auto&& push)
+        {
+            int64_t checksum = 0;
+            auto start = Clock::now();
+            std::thread consumer([&]
+            {
+                Event event;
+                for (int i = 0; i < messages; ++i)
+                {
+                    int misses = 0;
+                    while (!queue.TryPop(event))
+                        backoff(misses);
+                    checksum += event.Id;
+                }
+            });
+
+            for (int i = 0; i < messages; ++i)
+            {
+                int misses = 0;
+                while (!push(queue, i))
+                    backoff(misses);
+            }
+            consumer.join();
+
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            assert(checksum == int64_t(messages) * (messages - 1) / 2);
+            return std::pair(messages / seconds / 1e6, seconds * 1e9 / messages);
+        };
+
+        auto latency = [&](auto& ping, auto& pong)
+        {
+            auto send = [&](auto& queue, int id)
+            {
+                int misses = 0;
+                while (!queue.TryPush(Event { id, "ping" }))
+                    backoff(misses);
+            };
+            auto receive = [&](auto& queue, Event& event)
+            {
+                int misses = 0;
+                while (!queue.TryPop(event))
+                    backoff(misses);
+            };
+
+            std::thread echo([&]
+            {
+                Event event;
+                for (int i = 0; i < roundTrips; ++i)
+                {
+                    receive(ping, event);
+                    send(pong, event.Id);
+                }
+            });
+
+            Event event;
+            auto start = Clock::now();
+            for (int i = 0; i < roundTrips; ++i)
+            {
+                send(ping, i);
+                receive(pong, event);
+                assert(event.Id == i);
+            }
+            double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+            echo.join();
+            return elapsed / roundTrips / 2;
+        };
+
+        {
+            // Writes the message in place: the slot's string keeps its buffer
+            SpscChannel<Event> channel(capacity);
+            auto [rate, nsPerMessage] = throughput(channel, [](SpscChannel<Event>& queue, int id)
+            {
+                Event* slot = queue.Reserve();
+                if (!slot)
+                    return false;
+                slot->Id = id;
+                slot->Data.assign("payload");
+                queue.Commit();
+                return true;
+            });
+
+            SpscChannel<Event> ping(capacity), pong(capacity);
+            std::cout << "[SPSC] SpscChannel: " << rate << " Mmsg/s, " << nsPerMessage << " ns/msg, one-way latency "
+                      << latency(ping, pong) << " ns" << std::endl;
+        }
+
+        {
+            LockedEventQueue queue;
+            auto [rate, nsPerMessage] = throughput(queue, [](LockedEventQueue& locked, int id)
+            {
+                return locked.TryPush(Event { id, "payload" });
+            });
+
+            LockedEventQueue ping, pong;
+            std::cout << "[SPSC] EventQueue + mutex: " << rate << " Mmsg/s, " << nsPerMessage << " ns/msg, one-way latency "
+                      << latency(ping, pong) << " ns" << std::endl;
+        }
+    }
+}
+
+#endif // THREADS_SPSC_CHANNEL_HPP_
@@ -0,0 +1,220 @@
+#pragma once
+#ifndef THREADS_TASK_FUTURE_HPP_
+#define THREADS_TASK_FUTURE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace Threads
+{
+    // Shared state between a pool task and its TaskFuture. Compared to the state behind
+    // std::future it has no mutex and no condition variable: readiness is one atomic
+    // word that waiters block on with std::atomic::wait.
+    template <typename T>
+    class TaskState
+    {
+    public:
+        template <typename... Args>
+        void SetValue(Args&&... args)
+        {
+            if constexpr (!std::is_void_v<T>)
+                m_value.emplace(std::forward<Args>(args)...);
+            publish();
+        }
+
+        void SetException(std::exception_ptr error)
+        {
+            m_error = std::move(error);
+            publish();
+        }
+
+        bool IsReady() const { return m_ready.load(std::memory_order_acquire) != 0; }
+
+        void Wait() const
+        {
+            while (m_ready.load(std::memory_order_acquire) == 0)
+                m_ready.wait(0, std::memory_order_acquire);
+        }
+
+        T Get()
+        {
+            Wait();
+            if (m_error)
+                std::rethrow_exception(m_error);
+
+            if constexpr (!std::is_void_v<T>)
+                return std::move(*m_value);
+        }
+
+    private:
+        void publish()
+        {
+            m_ready.store(1, std::memory_order_release);
+            m_ready.notify_all();
+        }
+
+        std::atomic<uint32_t> m_ready = 0;
+        std::exception_ptr m_error;
+        std::optional<std::conditional_t<std::is_void_v<T>, char, T>> m_value;
+    };
+
+    template <typename T>
+    class TaskFuture
+    {
+    public:
+        TaskFuture() = default;
+        explicit TaskFuture(std::shared_ptr<TaskState<T>> state) : m_state(std::move(state)) { }
+
+        TaskFuture(TaskFuture&&) noexcept = default;
+        TaskFuture& operator=(TaskFuture&&) noexcept = default;
+
+        TaskFuture(const TaskFuture&) = delete;
+        TaskFuture& operator=(const TaskFuture&) = delete;
+
+        bool Valid() const { return m_state != nullptr; }
+        bool IsReady() const { return m_state->IsReady(); }
+        void Wait() const { m_state->Wait(); }
+
+        // Blocks until the task finished, then returns its result or rethrows its
+        // exception. Like std::future::get() it can only be called once.
+        T Get()
+        {
+            std::shared_ptr<TaskState<T>> state = std::move(m_state);
+            return state->Get();
+        }
+
+    private:
+        std::shared_ptr<TaskState<T>> m_state;
+    };
+
+    // The callable that Submit() puts into the pool. If it is destroyed without having
+    // run, the future reports broken_promise instead of blocking its owner forever.
+    template <typename R, typename F, typename... Args>
+    class SubmitCall
+    {
+    public:
+        SubmitCall(std::shared_ptr<TaskState<R>> state, F func, std::tuple<Args...> args)
+            : m_state(std::move(state)), m_func(std::move(func)), m_args(std::move(args)) { }
+
+        SubmitCall(SubmitCall&&) noexcept(std::is_nothrow_move_constructible_v<F>
+                                          && std::is_nothrow_move_constructible_v<std::tuple<Args...>>) = default;
+
+        ~SubmitCall()
+        {
+            if (m_state)
+                m_state->SetException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        }
+
+        void operator()()
+        {
+            std::shared_ptr<TaskState<R>> state = std::move(m_state);
+            try
+            {
+                if constexpr (std::is_void_v<R>)
+                {
+                    std::apply(m_func, std::move(m_args));
+                    state->SetValue();
+                }
+                else
+                {
+                    state->SetValue(std::apply(m_func, std::move(m_args)));
+                }
+            }
+            catch (...)
+            {
+                state->SetException(std::current_exception());
+            }
+        }
+
+    private:
+        std::shared_ptr<TaskState<R>> m_state;
+        F m_func;
+        std::tuple<Args...> m_args;
+    };
+
+    // One state for a whole SubmitBulk() call: the future becomes ready when the last
+    // element finished. The first exception thrown by any element is the one reported.
+    template <typename Iterator, typename F>
+    class BulkState : public TaskState<void>
+    {
+    public:
+        BulkState(size_t count, F func) : m_remaining(count), m_func(std::move(func)) { }
+
+        void Run(Iterator it)
+        {
+            try
+            {
+                std::invoke(m_func, *it);
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+            }
+            complete();
+        }
+
+        void Abandon()
+        {
+            fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            complete();
+        }
+
+    private:
+        void fail(std::exception_ptr error)
+        {
+            if (!m_failed.exchange(true, std::memory_order_relaxed))
+                m_error = std::move(error);
+        }
+
+        void complete()
+        {
+            if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+
+            if (m_error)
+                SetException(m_error);
+            else
+                SetValue();
+        }
+
+        std::atomic<size_t> m_remaining;
+        std::atomic<bool> m_failed = false;
+        std::exception_ptr m_error;
+        F m_func;
+    };
+
+    template <typename Iterator, typename F>
+    class BulkCall
+    {
+    public:
+        BulkCall(std::shared_ptr<BulkState<Iterator, F>> state, Iterator it)
+            : m_state(std::move(state)), m_it(std::move(it)) { }
+
+        BulkCall(BulkCall&&) noexcept(std::is_nothrow_move_constructible_v<Iterator>) = default;
+
+        ~BulkCall()
+        {
+            if (m_state)
+                m_state->Abandon();
+        }
+
+        void operator()()
+        {
+            std::exchange(m_state, nullptr)->Run(m_it);
+        }
+
+    private:
+        std::shared_ptr<BulkState<Iterator, F>> m_state;
+        Iterator m_it;
+    };
+}
+
+#endif // THREADS_TASK_FUTURE_HPP_
@@ -2,71 +2,444 @@
 #ifndef THREADS_THREAD_POOL_HPP_
 #define THREADS_THREAD_POOL_HPP_
 
-#include <condition_variable>
+#include "allocation_counter.hpp"
+#include "cpu_topology.hpp"
+#include "hardware.hpp"
+#include "inplace_task.hpp"
+#include "latency_histogram.hpp"
+#include "ring_deque.hpp"
+#include "task_future.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cassert>
+#include <cstdint>
+#include <ctime>
 #include <iostream>
 #include <functional>
+#include <iterator>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
+#ifndef THREADS_THREAD_POOL_METRICS
+    // Per-worker counters, timings and lock contention stats, see ThreadPool::GetMetrics().
+    // Define as 0 to compile all of it out; GetMetrics() then only reports queue depths.
+    #define THREADS_THREAD_POOL_METRICS 1
+#endif
+
+#ifndef THREADS_THREAD_POOL_TASK_CAPACITY
+    // Bytes of inline storage in every pool task, bigger captures go to the heap
+    #define THREADS_THREAD_POOL_TASK_CAPACITY 64
+#endif
+
 namespace Threads
 {
+    enum class SchedulingMode
+    {
+        // Every worker takes tasks from one queue guarded by one mutex
+        GlobalQueue,
+        // Every worker owns a deque; idle workers steal from the others
+        WorkStealing
+    };
+
+    enum class TaskPriority
+    {
+        // Latency-critical requests, always looked at first
+        Realtime,
+        // What Enqueue() and Submit() use when no priority is given
+        Normal,
+        // Batch work that only runs when nothing more urgent is waiting, or has
+        // waited long enough that starvation protection lets it through
+        Background
+    };
+
+    inline constexpr size_t TaskPriorityCount = 3;
+
+    // Counters of one priority lane, see ThreadPool::GetLaneStats()
+    struct LaneStats
+    {
+        size_t Depth = 0;
+        uint64_t Enqueued = 0;
+        uint64_t Dequeued = 0;
+        std::chrono::nanoseconds TotalWait { 0 };
+        std::chrono::nanoseconds MaxWait { 0 };
+
+        // Time between enqueue and a worker picking the task up
+        HistogramSnapshot WaitHistogram;
+    };
+
+    // What one worker slot did since the pool started
+    struct WorkerMetrics
+    {
+        uint64_t TasksExecuted = 0;
+        // Tasks this worker took from another worker's deque
+        uint64_t Steals = 0;
+        // Times the worker ran out of work and had to park
+        uint64_t Parks = 0;
+
+        std::chrono::nanoseconds BusyTime { 0 };
+        // Spinning, yielding and parked, from running dry until the next task
+        std::chrono::nanoseconds IdleTime { 0 };
+        // The part of IdleTime spent blocked in the kernel
+        std::chrono::nanoseconds ParkedTime { 0 };
+
+        HistogramSnapshot RunTime;
+    };
+
+    // Point-in-time view of a pool, see ThreadPool::GetMetrics(). Every counter is read
+    // relaxed and on its own, so the numbers are consistent with each other only roughly.
+    struct ThreadPoolMetrics
+    {
+        size_t Threads = 0;
+        int64_t Pending = 0;
+        std::array<LaneStats, TaskPriorityCount> Lanes;
+
+        // m_queueMutex: acquisitions, the ones that found it taken and their wait time
+        uint64_t QueueLockAcquisitions = 0;
+        uint64_t QueueLockContended = 0;
+        std::chrono::nanoseconds QueueLockWaitTime { 0 };
+
+        // One entry per worker slot ever started, including retired ones
+        std::vector<WorkerMetrics> Workers;
+
+        // Writes the snapshot as one JSON object, durations in nanoseconds
+        void ToJson(std::ostream& out) const
+        {
+            static constexpr const char* LaneNames[TaskPriorityCount] = { "Realtime", "Normal", "Background" };
+
+            out << "{\"threads\":" << Threads << ",\"pending\":" << Pending;
+            out << ",\"queueLock\":{\"acquisitions\":" << QueueLockAcquisitions
+                << ",\"contended\":" << QueueLockContended
+                << ",\"waitNs\":" << QueueLockWaitTime.count() << "}";
+
+            out << ",\"lanes\":[";
+            for (size_t i = 0; i < Lanes.size(); ++i)
+            {
+                const LaneStats& lane = Lanes[i];
+                out << (i ? "," : "") << "{\"name\":\"" << LaneNames[i] << "\""
+                    << ",\"depth\":" << lane.Depth
+                    << ",\"enqueued\":" << lane.Enqueued
+                    << ",\"dequeued\":" << lane.Dequeued
+                    << ",\"waitP50Ns\":" << std::min(lane.WaitHistogram.Percentile(50), lane.MaxWait).count()
+                    << ",\"waitP99Ns\":" << std::min(lane.WaitHistogram.Percentile(99), lane.MaxWait).count()
+                    << ",\"maxWaitNs\":" << lane.MaxWait.count() << "}";
+            }
+            out << "]";
+
+            out << ",\"workers\":[";
+            for (size_t i = 0; i < Workers.size(); ++i)
+            {
+                const WorkerMetrics& worker = Workers[i];
+                out << (i ? "," : "") << "{\"index\":" << i
+                    << ",\"tasks\":" << worker.TasksExecuted
+                    << ",\"steals\":" << worker.Steals
+                    << ",\"parks\":" << worker.Parks
+                    << ",\"busyNs\":" << worker.BusyTime.count()
+                    << ",\"idleNs\":" << worker.IdleTime.count()
+                    << ",\"parkedNs\":" << worker.ParkedTime.count()
+                    << ",\"runP50Ns\":" << worker.RunTime.Percentile(50).count()
+                    << ",\"runP99Ns\":" << worker.RunTime.Percentile(99).count() << "}";
+            }
+            out << "]}";
+        }
+    };
+
+    enum class ShutdownMode
+    {
+        // Run everything that is already queued, then stop
+        Drain,
+        // Drop queued tasks, only the ones already running are finished
+        Discard
+    };
+
+    // What a worker does when it runs out of tasks: spin with CpuRelax(), then yield
+    // its time slice, then park until a producer wakes it. Spinning trades CPU time
+    // for wakeup latency; workers adapt the actual spin length to the gaps they see.
+    struct IdlePolicy
+    {
+        uint32_t SpinCount = 0;
+        uint32_t YieldCount = 0;
+
+        // Parks right away: no CPU burnt while idle, every wakeup is a futex round trip
+        static constexpr IdlePolicy Park() { return { 0, 0 }; }
+        // Spins for a few microseconds, enough to bridge the gaps of a busy producer
+        static constexpr IdlePolicy Balanced() { return { 1'000, 16 }; }
+        // Stays hot for a few hundred microseconds, for latency-critical bursty load
+        static constexpr IdlePolicy Aggressive() { return { 20'000, 256 }; }
+    };
+
+    enum class AffinityMode
+    {
+        // Workers run wherever the scheduler puts them
+        None,
+        // Worker i is pinned to the i-th allowed CPU, filling one NUMA node after the other
+        Compact,
+        // Workers are dealt round-robin over the NUMA nodes
+        Scatter,
+        // Worker i is pinned to Cpus[i % Cpus.size()]
+        Explicit
+    };
+
+    struct ThreadPoolOptions
+    {
+        size_t NumThreads = std::thread::hardware_concurrency();
+        // Upper bound for Resize(), 0 means max(NumThreads, hardware_concurrency())
+        size_t MaxThreads = 0;
+        SchedulingMode Mode = SchedulingMode::GlobalQueue;
+        IdlePolicy Idle = IdlePolicy::Balanced();
+
+        AffinityMode Affinity = AffinityMode::None;
+        // Only used by AffinityMode::Explicit
+        std::vector<size_t> Cpus = { };
+
+        // Workers are named NamePrefix followed by their index, e.g. "io-3".
+        // Empty leaves the names alone. Linux cuts names at 15 characters.
+        std::string NamePrefix = { };
+    };
+
     class ThreadPool
     {
     public:
-        ThreadPool(size_t numThreads = std::thread::hardware_concurrency())
+        using Task = InplaceTask<THREADS_THREAD_POOL_TASK_CAPACITY>;
+        using Clock = std::chrono::steady_clock;
+
+        ThreadPool(size_t numThreads = std::thread::hardware_concurrency(),
+                   SchedulingMode mode = SchedulingMode::GlobalQueue,
+                   IdlePolicy idle = IdlePolicy::Balanced())
+            : ThreadPool(ThreadPoolOptions { .NumThreads = numThreads, .Mode = mode, .Idle = idle })
         {
-            // Creating worker threads
-            for (size_t i = 0; i < numThreads; ++i)
+        }
+
+        explicit ThreadPool(ThreadPoolOptions options)
+            : m_mode(options.Mode), m_idle(options.Idle), m_namePrefix(std::move(options.NamePrefix))
+        {
+            // hardware_concurrency() is allowed to return 0 when it can't tell
+            const size_t numThreads = std::max<size_t>(options.NumThreads, 1);
+
+            // Worker slots are allocated once, so that Resize() never moves
+            // a deque another worker might be stealing from
+            m_maxThreads = options.MaxThreads > 0 ? std::max(options.MaxThreads, numThreads)
+                                                  : std::max<size_t>(numThreads, std::thread::hardware_concurrency());
+            m_threads.resize(m_maxThreads);
+#if THREADS_THREAD_POOL_METRICS
+            m_counters = std::make_unique<WorkerCounters[]>(m_maxThreads);
+#endif
+
+            // Workers pin themselves before touching any memory, so that what they
+            // allocate lands on their own node with the kernel's first-touch policy
+            switch (options.Affinity)
             {
-                m_threads.emplace_back([this]
-                {
-                    while (true)
-                    {
-                        std::function<void()> task;
-                        // The reason for putting the below code
-                        // here is to unlock the queue before
-                        // executing the task so that other
-                        // threads can perform enqueue tasks
-                        {
-                            // Locking the queue so that data
-                            // can be shared safely
-                            std::unique_lock<std::mutex> lock(m_queueMutex);
-
-                            // Waiting until there is a task to
-                            // execute or the pool is stopped
-                            m_cv.wait(lock, [this]
-                            {
-                                return !m_tasks.empty() || m_stop;
-                            });
-
-                            // exit the thread in case the pool
-                            // is stopped and there are no tasks
-                            if (m_stop && m_tasks.empty())
-                                return;
-
-                            // Get the next task from the queue
-                            task = std::move(m_tasks.front());
-                            m_tasks.pop();
-                        }
-
-                        task();
-                    }
-                });
+            case AffinityMode::None:
+                break;
+            case AffinityMode::Compact:
+                m_workerCpus = CompactCpuOrder(NumaTopology());
+                break;
+            case AffinityMode::Scatter:
+                m_workerCpus = ScatterCpuOrder(NumaTopology());
+                break;
+            case AffinityMode::Explicit:
+                m_workerCpus = std::move(options.Cpus);
+                break;
+            }
+
+            m_lanes[static_cast<size_t>(TaskPriority::Realtime)].StarvationLimit = std::chrono::milliseconds(0);
+            m_lanes[static_cast<size_t>(TaskPriority::Normal)].StarvationLimit = std::chrono::milliseconds(10);
+            m_lanes[static_cast<size_t>(TaskPriority::Background)].StarvationLimit = std::chrono::milliseconds(100);
+
+            if (m_mode == SchedulingMode::WorkStealing)
+            {
+                // The deques have to exist before any worker starts stealing from them
+                for (size_t i = 0; i < m_maxThreads; ++i)
+                    m_queues.emplace_back(std::make_unique<WorkerQueue>());
             }
+
+            startWorkers(0, numThreads);
         }
 
         ~ThreadPool()
         {
+            Shutdown(ShutdownMode::Drain);
+        }
+
+        void Enqueue(Task task)
+        {
+            push(std::move(task));
+        }
+
+        // Builds the task directly inside the queue slot, so the callable is never
+        // wrapped in a temporary that then has to be moved into the queue
+        template <typename F>
+            requires (!std::is_same_v<std::decay_t<F>, Task> && std::is_invocable_v<std::decay_t<F>&>)
+        void Enqueue(F&& callable)
+        {
+            push(std::forward<F>(callable));
+        }
+
+        template <typename F>
+            requires std::is_invocable_v<std::decay_t<F>&>
+        void Enqueue(TaskPriority priority, F&& callable)
+        {
+            push(std::forward<F>(callable), priority);
+        }
+
+        // Within a lane, tasks run earliest-deadline-first. A task whose deadline has
+        // passed gets a share of the picks ahead of a busier Normal lane, so it is not
+        // stuck behind it, but it never goes ahead of waiting Realtime tasks.
+        // The task is built in place as well, but reordering the heap moves it again.
+        template <typename F>
+            requires std::is_invocable_v<std::decay_t<F>&>
+        void Enqueue(TaskPriority priority, Clock::time_point deadline, F&& callable)
+        {
+            push(std::forward<F>(callable), priority, deadline);
+        }
+
+        // Runs f(args...) on the pool and hands back a future for its result.
+        // Arguments are decay-copied into the task, like std::async does.
+        template <typename F, typename... Args>
+            requires std::is_invocable_v<std::decay_t<F>, std::decay_t<Args>...>
+        auto Submit(F&& func, Args&&... args)
+        {
+            using Result = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+            using Call = SubmitCall<Result, std::decay_t<F>, std::decay_t<Args>...>;
+
+            auto state = std::make_shared<TaskState<Result>>();
+            TaskFuture<Result> future(state);
+
+            push(Call(std::move(state), std::forward<F>(func), std::make_tuple(std::forward<Args>(args)...)));
+            return future;
+        }
+
+        template <typename F, typename... Args>
+            requires std::is_invocable_v<std::decay_t<F>, std::decay_t<Args>...>
+        auto Submit(TaskPriority priority, F&& func, Args&&... args)
+        {
+            using Result = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+            using Call = SubmitCall<Result, std::decay_t<F>, std::decay_t<Args>...>;
+
+            auto state = std::make_shared<TaskState<Result>>();
+            TaskFuture<Result> future(state);
+
+            push(Call(std::move(state), std::forward<F>(func), std::make_tuple(std::forward<Args>(args)...)), priority);
+            return future;
+        }
+
+        // Calls func(element) for every element of the range, one task per element.
+        // All tasks are queued under a single lock acquisition and only as many workers
+        // as there are tasks get woken, with one notify_all() when that is all of them,
+        // instead of paying one lock/notify pair per task.
+        // The range must stay alive until the returned future is ready.
+        template <std::ranges::forward_range Range, typename F>
+            requires std::is_invocable_v<std::decay_t<F>&, std::ranges::range_reference_t<Range>>
+        TaskFuture<void> SubmitBulk(Range&& range, F&& func)
+        {
+            using Iterator = std::ranges::iterator_t<Range>;
+            using State = BulkState<Iterator, std::decay_t<F>>;
+
+            const size_t count = static_cast<size_t>(std::ranges::distance(range));
+            auto state = std::make_shared<State>(count, std::forward<F>(func));
+            TaskFuture<void> future(state);
+
+            if (count == 0)
+            {
+                state->SetValue();
+                return future;
+            }
+
+            Iterator it = std::ranges::begin(range);
+            pushBulk(count, [&]
+            {
+                return BulkCall<Iterator, std::decay_t<F>>(state, it++);
+            });
+            return future;
+        }
+
+        // Blocks until every queued task has run and all workers are idle, without
+        // stopping the pool. Must not be called from one of the pool's own tasks.
+        void WaitIdle()
+        {
+            while (true)
+            {
+                uint32_t epoch = m_idleEpoch.load();
+                if (m_busy.load() == 0 && m_pending.load() <= 0)
+                    return;
+
+                // Woken by the last worker that runs out of work
+                m_idleEpoch.wait(epoch);
+            }
+        }
+
+        // Runs one queued task on the calling thread, if there is any. Lets a thread that
+        // waits for results of the pool help with the work instead of blocking a core,
+        // and is what keeps a worker that waits for its own subtasks from deadlocking.
+        bool RunPendingTask()
+        {
+            Task task;
+            if (t_currentPool == this)
+            {
+                if (!popNext(t_workerIndex, task))
+                    return false;
+
+                m_pending.fetch_sub(1);
+                task();
+                return true;
+            }
+
+            // Outsiders count as busy while they run a task, so that WaitIdle() waits for them too
+            m_busy.fetch_add(1);
+            bool found = (m_sharedQueued.load(std::memory_order_relaxed) > 0 && popShared(task))
+                      || (m_mode == SchedulingMode::WorkStealing && steal(m_maxThreads, task));
+            if (found)
+            {
+                m_pending.fetch_sub(1);
+                try
+                {
+                    task();
+                }
+                catch (...)
+                {
+                    markIdle();
+                    throw;
+                }
+            }
+            markIdle();
+            return found;
+        }
+
+        // Stops the pool and joins the workers. Enqueueing from outside the pool
+        // afterwards throws; tasks that are still running may keep spawning subtasks,
+        // which are run in Drain mode. Called with Drain by the destructor.
+        void Shutdown(ShutdownMode mode = ShutdownMode::Drain)
+        {
+            std::lock_guard<std::mutex> control(m_controlMutex);
+            if (m_shutdown)
+                return;
+
+            m_shutdown = true;
+            m_accepting.store(false);
+
+            // Destroying the tasks breaks the promises of their futures, which
+            // must not happen while we hold a queue lock
+            RingDeque<Task> discarded;
             {
                 // Lock the queue to update the stop flag safely
                 std::unique_lock<std::mutex> lock(m_queueMutex);
-                m_stop = true;
+                if (mode == ShutdownMode::Discard)
+                    takeQueuedTasks(discarded);
+                m_stop.store(true);
             }
 
             // Notify all threads
-            m_cv.notify_all();
+            wakeAllWorkers();
 
             // Joining all worker threads to ensure they have
             // completed their tasks
@@ -77,40 +450,1410 @@ namespace Threads
             }
         }
 
-        void Enqueue(std::function<void()> task)
+        // Grows or shrinks the number of workers at runtime. Queued tasks are never lost:
+        // a retiring worker finishes its current task and hands its deque to the others.
+        // Clamped to [1, MaxThreadCount()]. Must not be called from one of the pool's own tasks.
+        void Resize(size_t numThreads)
         {
+            std::lock_guard<std::mutex> control(m_controlMutex);
+            if (m_shutdown)
+                return;
+
+            numThreads = std::clamp<size_t>(numThreads, 1, m_maxThreads);
+            const size_t current = m_activeCount.load();
+
+            if (numThreads > current)
             {
-                std::unique_lock<std::mutex> lock(m_queueMutex);
-                m_tasks.emplace(std::move(task));
+                startWorkers(current, numThreads);
+                return;
+            }
+
+            if (numThreads < current)
+            {
+                // Workers check m_activeCount before parking and after every wakeup
+                m_activeCount.store(numThreads);
+                wakeAllWorkers();
+
+                for (size_t i = numThreads; i < current; ++i)
+                    m_threads[i].join();
+            }
+        }
+
+        // Starvation protection: a task that waited longer than this in its lane counts as
+        // overdue, and overdue Normal and Background tasks get a bounded share of the picks
+        // while a higher lane has work. Realtime is never held up by them.
+        // Defaults are 0 for Realtime, 10 ms for Normal and 100 ms for Background.
+        void SetStarvationLimit(TaskPriority priority, Clock::duration limit)
+        {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            m_lanes[static_cast<size_t>(priority)].StarvationLimit = limit;
+        }
+
+        // Queue depth and wait-time counters of one lane. In work-stealing mode
+        // Normal tasks without a deadline live on the worker deques and only
+        // show up in Normal's Depth, not in its wait times.
+        LaneStats GetLaneStats(TaskPriority priority) const
+        {
+            const Lane& lane = m_lanes[static_cast<size_t>(priority)];
+
+            LaneStats stats;
+            stats.Depth = lane.Depth.load(std::memory_order_relaxed);
+            stats.Enqueued = lane.Enqueued.load(std::memory_order_relaxed);
+            stats.Dequeued = lane.Dequeued.load(std::memory_order_relaxed);
+            stats.TotalWait = std::chrono::nanoseconds(lane.TotalWaitNs.load(std::memory_order_relaxed));
+            stats.MaxWait = std::chrono::nanoseconds(lane.MaxWaitNs.load(std::memory_order_relaxed));
+            stats.WaitHistogram = lane.WaitHistogram.Snapshot();
+
+            if (priority == TaskPriority::Normal)
+            {
+                for (size_t i = 0; i < m_queues.size(); ++i)
+                    stats.Depth += m_queues[i]->Size.load(std::memory_order_relaxed);
+            }
+            return stats;
+        }
+
+        // Cheap enough to poll from a monitoring thread: no locks, only relaxed loads
+        ThreadPoolMetrics GetMetrics() const
+        {
+            ThreadPoolMetrics metrics;
+            metrics.Threads = m_activeCount.load(std::memory_order_relaxed);
+            metrics.Pending = m_pending.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < TaskPriorityCount; ++i)
+                metrics.Lanes[i] = GetLaneStats(static_cast<TaskPriority>(i));
+
+#if THREADS_THREAD_POOL_METRICS
+            metrics.QueueLockAcquisitions = m_queueLockAcquisitions.load(std::memory_order_relaxed);
+            metrics.QueueLockContended = m_queueLockContended.load(std::memory_order_relaxed);
+            metrics.QueueLockWaitTime = std::chrono::nanoseconds(m_queueLockWaitNs.load(std::memory_order_relaxed));
+
+            const size_t slots = m_slotCount.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < slots; ++i)
+            {
+                const WorkerCounters& counters = m_counters[i];
+
+                WorkerMetrics worker;
+                worker.TasksExecuted = counters.TasksExecuted.load(std::memory_order_relaxed);
+                worker.Steals = counters.Steals.load(std::memory_order_relaxed);
+                worker.Parks = counters.Parks.load(std::memory_order_relaxed);
+                worker.BusyTime = std::chrono::nanoseconds(counters.BusyNs.load(std::memory_order_relaxed));
+                worker.IdleTime = std::chrono::nanoseconds(counters.IdleNs.load(std::memory_order_relaxed));
+                worker.ParkedTime = std::chrono::nanoseconds(counters.ParkedNs.load(std::memory_order_relaxed));
+                worker.RunTime = counters.RunTime.Snapshot();
+                metrics.Workers.push_back(worker);
             }
-            m_cv.notify_one();
+#endif
+            return metrics;
         }
 
+        size_t ThreadCount() const { return m_activeCount.load(); }
+
+        size_t MaxThreadCount() const { return m_maxThreads; }
+
+        SchedulingMode Mode() const { return m_mode; }
+
+        IdlePolicy Idle() const { return m_idle; }
+
     private:
-        std::vector<std::thread> m_threads;
-        std::queue<std::function<void()>> m_tasks;
-        std::mutex m_queueMutex;
-        std::condition_variable m_cv;
+        // Padded to a cache line so that two workers touching their own
+        // deques never invalidate each other's lines
+        struct alignas(CacheLineSize) WorkerQueue
+        {
+            std::mutex Mutex;
+            RingDeque<Task> Tasks;
 
-        bool m_stop = false;
-    };
+            // Lets thieves skip empty deques without taking their mutex
+            std::atomic<size_t> Size = 0;
 
-    int RuntTest()
-    {
-        // Create a thread pool with 4 threads
-        Threads::ThreadPool pool(4);
+            // Set under Mutex when the owner retired, producers have to pick another deque
+            bool Closed = false;
+        };
 
-        // Enqueue tasks for execution
-        for (int i = 0; i < 5; ++i)
+#if THREADS_THREAD_POOL_METRICS
+        // Written only by the worker that owns the slot, read by GetMetrics(). One
+        // writer means plain load+store instead of a locked read-modify-write, and
+        // the padding keeps the slots of two workers off each other's cache lines.
+        struct alignas(CacheLineSize) WorkerCounters
         {
-            pool.Enqueue([i] {
-                std::cout << "Task " << i << " is running on thread " << std::this_thread::get_id() << std::endl;
-                // Simulate some work
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            });
+            std::atomic<uint64_t> TasksExecuted = 0;
+            std::atomic<uint64_t> Steals = 0;
+            std::atomic<uint64_t> Parks = 0;
+            std::atomic<uint64_t> BusyNs = 0;
+            std::atomic<uint64_t> IdleNs = 0;
+            std::atomic<uint64_t> ParkedNs = 0;
+            LatencyHistogram RunTime;
+        };
+
+        static void add(std::atomic<uint64_t>& counter, uint64_t value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        static uint64_t nanosecondsSince(Clock::time_point start)
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        }
+#endif
+
+        struct QueuedTask
+        {
+            // Wraps the callable right where the queue constructs the entry
+            template <typename F>
+            QueuedTask(F&& work, Clock::time_point enqueued, Clock::time_point deadline)
+                : Work(std::forward<F>(work)), Enqueued(enqueued), Deadline(deadline)
+            {
+            }
+
+            Task Work;
+            Clock::time_point Enqueued;
+            // The explicit deadline, or Enqueued + the lane's starvation limit
+            Clock::time_point Deadline;
+        };
+
+        struct LaterDeadline
+        {
+            bool operator()(const QueuedTask& lhs, const QueuedTask& rhs) const { return lhs.Deadline > rhs.Deadline; }
+        };
+
+        // One priority class of the shared queue, guarded by m_queueMutex. The counters
+        // are atomics only so that GetLaneStats() can read them without the lock.
+        struct Lane
+        {
+            // Tasks without a deadline. Their effective deadlines are in FIFO order too.
+            RingDeque<QueuedTask> Fifo;
+            // Tasks with an explicit deadline, as a min-heap on Deadline
+            std::vector<QueuedTask> Deadlines;
+            Clock::duration StarvationLimit { 0 };
+
+            std::atomic<size_t> Depth = 0;
+            std::atomic<uint64_t> Enqueued = 0;
+            std::atomic<uint64_t> Dequeued = 0;
+            std::atomic<uint64_t> TotalWaitNs = 0;
+            std::atomic<uint64_t> MaxWaitNs = 0;
+            LatencyHistogram WaitHistogram;
+
+            bool Empty() const { return Fifo.Empty() && Deadlines.empty(); }
+
+            // The most urgent task of this lane, or nullptr
+            const QueuedTask* Best()
+            {
+                if (Deadlines.empty())
+                    return Fifo.Empty() ? nullptr : &Fifo.Front();
+                if (Fifo.Empty() || Deadlines.front().Deadline < Fifo.Front().Deadline)
+                    return &Deadlines.front();
+                return &Fifo.Front();
+            }
+
+            QueuedTask PopBest()
+            {
+                if (!Deadlines.empty() && (Fifo.Empty() || Deadlines.front().Deadline < Fifo.Front().Deadline))
+                {
+                    std::pop_heap(Deadlines.begin(), Deadlines.end(), LaterDeadline());
+                    QueuedTask task = std::move(Deadlines.back());
+                    Deadlines.pop_back();
+                    return task;
+                }
+                return Fifo.PopFront();
+            }
+        };
+
+        void startWorkers(size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; ++i)
+            {
+                if (m_mode == SchedulingMode::WorkStealing)
+                {
+                    std::lock_guard<std::mutex> lock(m_queues[i]->Mutex);
+                    m_queues[i]->Closed = false;
+                }
+            }
+
+            m_slotCount.store(std::max(m_slotCount.load(), last));
+            m_activeCount.store(last);
+
+            // Creating worker threads
+            for (size_t i = first; i < last; ++i)
+            {
+                m_threads[i] = std::thread([this, i] { workerLoop(i); });
+            }
+        }
+
+        bool retiring(size_t index) const
+        {
+            return index >= m_activeCount.load();
+        }
+
+        // Called by a worker that ran out of work. The last one to do so wakes WaitIdle().
+        void markIdle()
+        {
+            if (m_busy.fetch_sub(1) == 1 && m_pending.load() <= 0)
+            {
+                m_idleEpoch.fetch_add(1);
+                m_idleEpoch.notify_all();
+            }
+        }
+
+        void workerLoop(size_t index)
+        {
+            t_currentPool = this;
+            t_workerIndex = index;
+
+            if (!m_workerCpus.empty())
+                PinCurrentThread(m_workerCpus[index % m_workerCpus.size()]);
+            if (!m_namePrefix.empty())
+            {
+                // Shorten the prefix rather than the index, which is what tells workers apart
+                std::string suffix = std::to_string(index);
+                NameCurrentThread(m_namePrefix.substr(0, 15 - std::min<size_t>(suffix.size(), 15)) + suffix);
+            }
+
+            m_busy.fetch_add(1);
+
+            // How long this worker spins before yielding, adapted to the gaps it actually sees
+            uint32_t spinLimit = m_idle.SpinCount;
+#if THREADS_THREAD_POOL_METRICS
+            // End of the previous task or wait, so that every task costs one clock read
+            Clock::time_point stamp = Clock::now();
+#endif
+
+            while (true)
+            {
+                if (retiring(index))
+                {
+                    if (m_mode == SchedulingMode::WorkStealing)
+                        retireQueue(index);
+
+                    // We may have consumed the wakeup meant for a task
+                    if (m_pending.load() > 0)
+                        wakeSleepingWorkers(1);
+
+                    markIdle();
+                    return;
+                }
+
+                Task task;
+                if (popNext(index, task))
+                {
+                    m_pending.fetch_sub(1);
+#if THREADS_THREAD_POOL_METRICS
+                    runTask(index, task, stamp);
+#else
+                    task();
+#endif
+                    continue;
+                }
+
+                markIdle();
+
+                // exit the thread in case the pool is stopped and there are no tasks
+                if (m_stop.load() && m_pending.load() <= 0)
+                    return;
+
+#if THREADS_THREAD_POOL_METRICS
+                const Clock::time_point idleStart = Clock::now();
+                waitForWork(index, spinLimit);
+                stamp = Clock::now();
+                add(m_counters[index].IdleNs, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(stamp - idleStart).count()));
+#else
+                waitForWork(index, spinLimit);
+#endif
+                m_busy.fetch_add(1);
+            }
+        }
+
+#if THREADS_THREAD_POOL_METRICS
+        // The run time of a task includes taking it off the queue, which is what
+        // lets back-to-back tasks share their clock reads
+        void runTask(size_t index, Task& task, Clock::time_point& stamp)
+        {
+            task();
+            const Clock::time_point now = Clock::now();
+            const uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - stamp).count());
+            stamp = now;
+
+            WorkerCounters& counters = m_counters[index];
+            add(counters.TasksExecuted, 1);
+            add(counters.BusyNs, elapsed);
+            counters.RunTime.Record(std::chrono::nanoseconds(elapsed));
+        }
+#endif
+
+        bool hasWork(size_t index) const
+        {
+            return m_pending.load() > 0 || m_stop.load() || retiring(index);
+        }
+
+        // Spins, then yields, then parks until a producer publishes work. Most gaps
+        // between bursts are shorter than a futex round trip, so a worker that is
+        // still spinning picks the next task up without any syscall on either side.
+        void waitForWork(size_t index, uint32_t& spinLimit)
+        {
+            // Below this, growing back by doubling would take forever
+            const uint32_t minSpin = std::min<uint32_t>(m_idle.SpinCount, 16);
+
+            for (uint32_t i = 0; i < spinLimit; ++i)
+            {
+                if (hasWork(index))
+                {
+                    spinLimit = std::clamp(spinLimit * 2, minSpin, m_idle.SpinCount);
+                    return;
+                }
+                CpuRelax();
+            }
+
+            for (uint32_t i = 0; i < m_idle.YieldCount; ++i)
+            {
+                if (hasWork(index))
+                {
+                    spinLimit = std::clamp(spinLimit * 2, minSpin, m_idle.SpinCount);
+                    return;
+                }
+                std::this_thread::yield();
+            }
+
+            // Spinning didn't pay off this time, burn less CPU on the next gap
+            spinLimit = std::max(spinLimit / 2, minSpin);
+
+            // m_sleeping and m_pending form a Dekker pair with wakeSleepingWorkers():
+            // either the producer sees us as sleeping and bumps the epoch, or we see its task.
+            // Reading the epoch before checking for work means a bump in between isn't lost.
+#if THREADS_THREAD_POOL_METRICS
+            const Clock::time_point parkStart = Clock::now();
+#endif
+            m_sleeping.fetch_add(1);
+            while (true)
+            {
+                uint32_t epoch = m_wakeEpoch.load();
+                if (hasWork(index))
+                    break;
+                m_wakeEpoch.wait(epoch);
+            }
+            m_sleeping.fetch_sub(1);
+#if THREADS_THREAD_POOL_METRICS
+            add(m_counters[index].Parks, 1);
+            add(m_counters[index].ParkedNs, nanosecondsSince(parkStart));
+#endif
+        }
+
+        template <typename T>
+        void push(T&& task, TaskPriority priority = TaskPriority::Normal,
+                  std::optional<Clock::time_point> deadline = std::nullopt)
+        {
+            if (!m_accepting.load(std::memory_order_relaxed) && t_currentPool != this)
+                throw std::runtime_error("ThreadPool: Enqueue after Shutdown");
+
+            // Plain Normal tasks go to the worker deques, everything that needs
+            // ordering goes through the lanes of the shared queue
+            if (m_mode == SchedulingMode::WorkStealing && priority == TaskPriority::Normal && !deadline)
+            {
+                pushWorkStealing(std::forward<T>(task));
+                return;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock = lockQueue();
+                pushSharedLocked(std::forward<T>(task), priority, deadline, Clock::now());
+                m_pending.fetch_add(1);
+            }
+
+            wakeSleepingWorkers(1);
+        }
+
+        template <typename T>
+        void pushSharedLocked(T&& task, TaskPriority priority, std::optional<Clock::time_point> deadline, Clock::time_point now)
+        {
+            Lane& lane = m_lanes[static_cast<size_t>(priority)];
+
+            if (deadline)
+            {
+                lane.Deadlines.emplace_back(std::forward<T>(task), now, *deadline);
+                std::push_heap(lane.Deadlines.begin(), lane.Deadlines.end(), LaterDeadline());
+            }
+            else
+            {
+                lane.Fifo.EmplaceBack(std::forward<T>(task), now, now + lane.StarvationLimit);
+            }
+
+            lane.Depth.fetch_add(1, std::memory_order_relaxed);
+            lane.Enqueued.fetch_add(1, std::memory_order_relaxed);
+            m_sharedQueued.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Takes m_queueMutex on the hot paths. Only a failed try_lock() pays for
+        // timing the wait; the acquisition counter is only written under the lock.
+        std::unique_lock<std::mutex> lockQueue()
+        {
+#if THREADS_THREAD_POOL_METRICS
+            std::unique_lock<std::mutex> lock(m_queueMutex, std::try_to_lock);
+            if (!lock.owns_lock())
+            {
+                const Clock::time_point start = Clock::now();
+                lock.lock();
+                m_queueLockContended.fetch_add(1, std::memory_order_relaxed);
+                m_queueLockWaitNs.fetch_add(nanosecondsSince(start), std::memory_order_relaxed);
+            }
+            add(m_queueLockAcquisitions, 1);
+            return lock;
+#else
+            return std::unique_lock<std::mutex>(m_queueMutex);
+#endif
+        }
+
+        // Picks the most urgent task of the shared queue, which must not be empty.
+        // Waiting Realtime tasks always go first. Otherwise the highest non-empty lane
+        // wins, except that every AgedPickInterval-th pick made while a lower lane has
+        // an overdue task goes to the earliest of those. A lower lane can't starve, and
+        // however deep its backlog, it can't starve the lanes above it either.
+        Task popSharedLocked()
+        {
+            static constexpr uint32_t AgedPickInterval = 4;
+
+            const Clock::time_point now = Clock::now();
+
+            size_t highest = 0;
+            while (m_lanes[highest].Empty())
+                ++highest;
+            Lane* chosen = &m_lanes[highest];
+
+            if (highest != static_cast<size_t>(TaskPriority::Realtime))
+            {
+                Lane* overdue = nullptr;
+                Clock::time_point earliest = Clock::time_point::max();
+                for (size_t i = highest + 1; i < m_lanes.size(); ++i)
+                {
+                    const QueuedTask* best = m_lanes[i].Best();
+                    if (best && best->Deadline <= now && best->Deadline < earliest)
+                    {
+                        overdue = &m_lanes[i];
+                        earliest = best->Deadline;
+                    }
+                }
+
+                if (overdue && ++m_agedPicks % AgedPickInterval == 0)
+                    chosen = overdue;
+            }
+
+            QueuedTask task = chosen->PopBest();
+
+            uint64_t waitNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - task.Enqueued).count());
+            chosen->Depth.fetch_sub(1, std::memory_order_relaxed);
+            chosen->Dequeued.fetch_add(1, std::memory_order_relaxed);
+            chosen->TotalWaitNs.fetch_add(waitNs, std::memory_order_relaxed);
+            if (waitNs > chosen->MaxWaitNs.load(std::memory_order_relaxed))
+                chosen->MaxWaitNs.store(waitNs, std::memory_order_relaxed);
+            chosen->WaitHistogram.Record(std::chrono::nanoseconds(waitNs));
+            m_sharedQueued.fetch_sub(1, std::memory_order_relaxed);
+
+            return std::move(task.Work);
+        }
+
+        bool popShared(Task& task)
+        {
+            std::unique_lock<std::mutex> lock = lockQueue();
+            if (m_sharedQueued.load(std::memory_order_relaxed) == 0)
+                return false;
+
+            task = popSharedLocked();
+            return true;
+        }
+
+        // Work-stealing order: realtime tasks from the shared queue, our own deque,
+        // the rest of the shared queue, then the other workers' deques. Every
+        // FairnessInterval tasks the shared queue goes first regardless, so deadlines
+        // and background work keep moving while the deques are never empty.
+        bool popNext(size_t index, Task& task)
+        {
+            static constexpr uint32_t FairnessInterval = 32;
+
+            if (m_mode == SchedulingMode::GlobalQueue)
+                return m_sharedQueued.load(std::memory_order_relaxed) > 0 && popShared(task);
+
+            if (m_sharedQueued.load(std::memory_order_relaxed) > 0)
+            {
+                bool realtime = m_lanes[static_cast<size_t>(TaskPriority::Realtime)].Depth.load(std::memory_order_relaxed) > 0;
+                if ((realtime || ++t_fairnessTick % FairnessInterval == 0) && popShared(task))
+                    return true;
+            }
+
+            if (popLocal(index, task))
+                return true;
+
+            if (m_sharedQueued.load(std::memory_order_relaxed) > 0 && popShared(task))
+                return true;
+
+            return steal(index, task);
+        }
+
+        // makeTask() is called count times, always under a queue lock
+        template <typename MakeTask>
+        void pushBulk(size_t count, MakeTask&& makeTask)
+        {
+            if (!m_accepting.load(std::memory_order_relaxed) && t_currentPool != this)
+                throw std::runtime_error("ThreadPool: Enqueue after Shutdown");
+
+            if (m_mode == SchedulingMode::GlobalQueue)
+            {
+                {
+                    std::unique_lock<std::mutex> lock = lockQueue();
+                    const Clock::time_point now = Clock::now();
+                    for (size_t i = 0; i < count; ++i)
+                        pushSharedLocked(makeTask(), TaskPriority::Normal, std::nullopt, now);
+                    m_pending.fetch_add(static_cast<int64_t>(count));
+                }
+                wakeSleepingWorkers(count);
+                return;
+            }
+
+            if (t_currentPool == this)
+            {
+                // Everything goes to our own deque, idle workers will steal their share
+                pushToOpenQueue(t_workerIndex, count, makeTask);
+            }
+            else
+            {
+                // One contiguous slice per worker: one lock per deque instead of one per task
+                const size_t queues = m_activeCount.load(std::memory_order_relaxed);
+                thread_local size_t t_bulkCursor = std::hash<std::thread::id>()(std::this_thread::get_id());
+                size_t first = t_bulkCursor++;
+                for (size_t q = 0; q < queues && q < count; ++q)
+                {
+                    size_t slice = count / queues + (q < count % queues ? 1 : 0);
+                    pushToOpenQueue(first + q, slice, makeTask);
+                }
+            }
+
+            m_pending.fetch_add(static_cast<int64_t>(count));
+            wakeSleepingWorkers(count);
+        }
+
+        template <typename T>
+        void pushWorkStealing(T&& task)
+        {
+            size_t index = 0;
+            if (t_currentPool == this)
+            {
+                // Tasks spawned by a worker stay on its own deque, where they are
+                // still hot in cache and cost no cross-core traffic to pick up
+                index = t_workerIndex;
+            }
+            else
+            {
+                // External producers spread their tasks round-robin. The cursor is
+                // thread-local, so producers never write to a shared cache line.
+                thread_local size_t t_cursor = std::hash<std::thread::id>()(std::this_thread::get_id());
+                index = t_cursor++;
+            }
+
+            auto makeTask = [&task]() -> T&& { return std::forward<T>(task); };
+            pushToOpenQueue(index, 1, makeTask);
+
+            m_pending.fetch_add(1);
+            wakeSleepingWorkers(1);
+        }
+
+        // Pushes count tasks into the deque of worker index, or of the next worker
+        // whose deque is still open when Resize() just retired that one
+        template <typename MakeTask>
+        void pushToOpenQueue(size_t index, size_t count, MakeTask& makeTask)
+        {
+            while (true)
+            {
+                WorkerQueue& queue = *m_queues[index % std::max<size_t>(m_activeCount.load(), 1)];
+
+                std::lock_guard<std::mutex> lock(queue.Mutex);
+                if (queue.Closed)
+                {
+                    ++index;
+                    continue;
+                }
+
+                for (size_t i = 0; i < count; ++i)
+                    queue.Tasks.EmplaceBack(makeTask());
+                queue.Size.store(queue.Tasks.Size(), std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        void wakeSleepingWorkers(size_t count)
+        {
+            // Spinning workers find the task by themselves, only parked ones need a syscall
+            size_t sleeping = m_sleeping.load();
+            if (sleeping == 0)
+                return;
+
+            m_wakeEpoch.fetch_add(1);
+            if (count >= sleeping)
+            {
+                m_wakeEpoch.notify_all();
+                return;
+            }
+
+            for (size_t i = 0; i < count; ++i)
+                m_wakeEpoch.notify_one();
+        }
+
+        // For stop and retirement, which every worker has to notice
+        void wakeAllWorkers()
+        {
+            m_wakeEpoch.fetch_add(1);
+            m_wakeEpoch.notify_all();
+        }
+
+        // Closes the deque of a worker that Resize() asked to leave and
+        // hands its tasks over to the workers that stay
+        void retireQueue(size_t index)
+        {
+            RingDeque<Task> orphans;
+            {
+                WorkerQueue& queue = *m_queues[index];
+                std::lock_guard<std::mutex> lock(queue.Mutex);
+                queue.Closed = true;
+                while (!queue.Tasks.Empty())
+                    orphans.EmplaceBack(queue.Tasks.PopFront());
+                queue.Size.store(0, std::memory_order_relaxed);
+            }
+
+            const size_t count = orphans.Size();
+            auto next = [&orphans] { return orphans.PopFront(); };
+            for (size_t i = 0; i < count; ++i)
+                pushToOpenQueue(index + i, 1, next);
+
+            // m_pending already counts them, only the sleepers need to know
+            if (count > 0)
+                wakeSleepingWorkers(count);
+        }
+
+        // Moves every queued task into discarded and takes it off the books.
+        // Called with m_queueMutex held.
+        void takeQueuedTasks(RingDeque<Task>& discarded)
+        {
+            size_t count = 0;
+            for (Lane& lane : m_lanes)
+            {
+                while (!lane.Empty())
+                {
+                    discarded.EmplaceBack(std::move(lane.PopBest().Work));
+                    ++count;
+                }
+                lane.Depth.store(0, std::memory_order_relaxed);
+            }
+            m_sharedQueued.store(0, std::memory_order_relaxed);
+
+            for (size_t i = 0; i < m_queues.size(); ++i)
+            {
+                WorkerQueue& queue = *m_queues[i];
+                std::lock_guard<std::mutex> lock(queue.Mutex);
+                while (!queue.Tasks.Empty())
+                {
+                    discarded.EmplaceBack(queue.Tasks.PopFront());
+                    ++count;
+                }
+                queue.Size.store(0, std::memory_order_relaxed);
+            }
+
+            m_pending.fetch_sub(static_cast<int64_t>(count));
+        }
+
+        bool popLocal(size_t index, Task& task)
+        {
+            WorkerQueue& queue = *m_queues[index];
+            if (queue.Size.load(std::memory_order_relaxed) == 0)
+                return false;
+
+            std::lock_guard<std::mutex> lock(queue.Mutex);
+            if (queue.Tasks.Empty())
+                return false;
+
+            // The owner works LIFO: the newest task is the one most likely to be in cache
+            task = queue.Tasks.PopBack();
+            queue.Size.store(queue.Tasks.Size(), std::memory_order_relaxed);
+            return true;
+        }
+
+        // A thief of m_maxThreads or more is a thread outside the pool, it may take from every deque
+        bool steal(size_t thief, Task& task)
+        {
+            // Retiring workers may still hold tasks for a moment, so look at every slot ever used
+            const size_t count = m_slotCount.load(std::memory_order_relaxed);
+            for (size_t offset = 1; offset <= count; ++offset)
+            {
+                const size_t victimIndex = (thief + offset) % count;
+                if (victimIndex == thief)
+                    continue;
+
+                WorkerQueue& victim = *m_queues[victimIndex];
+                if (victim.Size.load(std::memory_order_relaxed) == 0)
+                    continue;
+
+                // Don't queue up behind the owner or another thief, just try the next victim
+                std::unique_lock<std::mutex> lock(victim.Mutex, std::try_to_lock);
+                if (!lock.owns_lock() || victim.Tasks.Empty())
+                    continue;
+
+                // Thieves take the oldest task, which is the furthest from the owner's hot end
+                task = victim.Tasks.PopFront();
+                victim.Size.store(victim.Tasks.Size(), std::memory_order_relaxed);
+#if THREADS_THREAD_POOL_METRICS
+                if (thief < m_maxThreads)
+                    add(m_counters[thief].Steals, 1);
+#endif
+                return true;
+            }
+            return false;
+        }
+
+        const SchedulingMode m_mode;
+        const IdlePolicy m_idle;
+        const std::string m_namePrefix;
+        // CPU of worker i is m_workerCpus[i % size], empty when workers aren't pinned
+        std::vector<size_t> m_workerCpus;
+        size_t m_maxThreads = 0;
+
+        // Slot i holds worker i; only Resize()/Shutdown() touch it, under m_controlMutex
+        std::vector<std::thread> m_threads;
+        std::mutex m_controlMutex;
+        bool m_shutdown = false;
+
+        std::array<Lane, TaskPriorityCount> m_lanes;
+        // Tasks in all lanes, read without the lock to skip an empty shared queue
+        std::atomic<size_t> m_sharedQueued = 0;
+        std::mutex m_queueMutex;
+        // Picks made while a lower lane had an overdue task, guarded by m_queueMutex
+        uint32_t m_agedPicks = 0;
+#if THREADS_THREAD_POOL_METRICS
+        std::atomic<uint64_t> m_queueLockAcquisitions = 0;
+        std::atomic<uint64_t> m_queueLockContended = 0;
+        std::atomic<uint64_t> m_queueLockWaitNs = 0;
+        std::unique_ptr<WorkerCounters[]> m_counters;
+#endif
+
+        std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+        // Tasks sitting in a queue. Signed because in work-stealing mode a task
+        // may be popped before its producer has incremented the counter.
+        std::atomic<int64_t> m_pending = 0;
+        std::atomic<size_t> m_sleeping = 0;
+        // Parked workers wait on this word, producers bump it to wake them
+        std::atomic<uint32_t> m_wakeEpoch = 0;
+
+        // Workers [0, m_activeCount) take work, the ones above are retiring.
+        // m_slotCount is the highest slot ever started.
+        std::atomic<size_t> m_activeCount = 0;
+        std::atomic<size_t> m_slotCount = 0;
+
+        // Workers that are running or looking for a task. Only changes when a worker
+        // runs dry or wakes up, never per task, so it doesn't add a hot shared write.
+        std::atomic<size_t> m_busy = 0;
+        std::atomic<uint32_t> m_idleEpoch = 0;
+
+        std::atomic<bool> m_accepting = true;
+        std::atomic<bool> m_stop = false;
+
+        static inline thread_local ThreadPool* t_currentPool = nullptr;
+        static inline thread_local size_t t_workerIndex = 0;
+        static inline thread_local uint32_t t_fairnessTick = 0;
+    };
+
+    // One ThreadPool per NUMA node, each with one worker pinned to every CPU of its node.
+    // Work enqueued through Local() stays on the node of the thread that produced it,
+    // so its data is read from the local memory controller and the node's own LLC.
+    class NumaThreadPools
+    {
+    public:
+        // Mode, Idle and NamePrefix apply to every pool, the size and placement of each
+        // pool follow its node. Workers are named NamePrefix + node + "-" + index.
+        explicit NumaThreadPools(ThreadPoolOptions options = { })
+            : m_nodes(NumaTopology())
+        {
+            for (size_t i = 0; i < m_nodes.size(); ++i)
+            {
+                const NumaNode& node = m_nodes[i];
+
+                ThreadPoolOptions nodeOptions = options;
+                nodeOptions.NumThreads = node.Cpus.size();
+                nodeOptions.MaxThreads = node.Cpus.size();
+                nodeOptions.Affinity = AffinityMode::Explicit;
+                nodeOptions.Cpus = node.Cpus;
+                if (!options.NamePrefix.empty())
+                    nodeOptions.NamePrefix = options.NamePrefix + std::to_string(node.Id) + "-";
+
+                m_pools.push_back(std::make_unique<ThreadPool>(std::move(nodeOptions)));
+
+                for (size_t cpu : node.Cpus)
+                {
+                    if (cpu >= m_poolOfCpu.size())
+                        m_poolOfCpu.resize(cpu + 1, 0);
+                    m_poolOfCpu[cpu] = i;
+                }
+            }
+        }
+
+        size_t NodeCount() const { return m_nodes.size(); }
+
+        const NumaNode& Node(size_t index) const { return m_nodes[index]; }
+
+        ThreadPool& Pool(size_t index) { return *m_pools[index]; }
+
+        // The pool of the node the calling thread is running on. Unpinned threads may
+        // migrate at any time, so for them this is a hint, which is all it needs to be.
+        ThreadPool& Local()
+        {
+            int cpu = CurrentCpu();
+            if (cpu < 0 || static_cast<size_t>(cpu) >= m_poolOfCpu.size())
+                return *m_pools[0];
+            return *m_pools[m_poolOfCpu[cpu]];
+        }
+
+        template <typename F>
+        void Enqueue(F&& callable)
+        {
+            Local().Enqueue(std::forward<F>(callable));
+        }
+
+        template <typename F, typename... Args>
+        auto Submit(F&& func, Args&&... args)
+        {
+            return Local().Submit(std::forward<F>(func), std::forward<Args>(args)...);
+        }
+
+        void WaitIdle()
+        {
+            for (auto& pool : m_pools)
+                pool->WaitIdle();
+        }
+
+    private:
+        std::vector<NumaNode> m_nodes;
+        std::vector<std::unique_ptr<ThreadPool>> m_pools;
+        // Index into m_pools for every CPU id
+        std::vector<size_t> m_poolOfCpu;
+    };
+
+    int RuntTest()
+    {
+        // Create a thread pool with 4 threads
+        Threads::ThreadPool pool(4);
+
+        // Enqueue tasks for execution
+        for (int i = 0; i < 5; ++i)
+        {
+            pool.Enqueue([i] {
+                std::cout << "Task " << i << " is running on thread " << std::this_thread::get_id() << std::endl;
+                // Simulate some work
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            });
+        }
+        return 0;
+    }
+
+    // Runs a mixed workload and writes the pool's metrics as JSON, for scraping by a
+    // monitoring agent or a jq one-liner. With THREADS_THREAD_POOL_METRICS set to 0
+    // the same call still works and only reports queue depths.
+    void DumpThreadPoolMetrics(std::ostream& out)
+    {
+        ThreadPool pool(ThreadPoolOptions
+        {
+            .NumThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1),
+            .Mode = SchedulingMode::WorkStealing,
+            .NamePrefix = "metrics-"
+        });
+
+        auto spinFor = [](std::chrono::microseconds busy)
+        {
+            auto end = ThreadPool::Clock::now() + busy;
+            while (ThreadPool::Clock::now() < end) { }
+        };
+
+        // Fan-out from inside the pool, which exercises the deques and stealing
+        std::atomic<size_t> done = 0;
+        for (size_t root = 0; root < pool.ThreadCount(); ++root)
+        {
+            pool.Enqueue([&pool, &done, &spinFor]
+            {
+                for (int i = 0; i < 1'000; ++i)
+                {
+                    pool.Enqueue([&done, &spinFor, i]
+                    {
+                        spinFor(std::chrono::microseconds(i % 10));
+                        done.fetch_add(1, std::memory_order_relaxed);
+                    });
+                }
+            });
+        }
+
+        // External producers going through the shared queue and its lock
+        for (int i = 0; i < 1'000; ++i)
+            pool.Enqueue(i % 10 == 0 ? TaskPriority::Realtime : TaskPriority::Background, [&spinFor] { spinFor(std::chrono::microseconds(5)); });
+
+        pool.WaitIdle();
+        pool.GetMetrics().ToJson(out);
+        out << std::endl;
+    }
+
+    // Checks that small captures go through the pool without a single heap allocation
+    // per task: the callable lives inside the task and the queues reuse their buffers.
+    // Counts the real heap, on every thread, so the queues and the workers are covered too.
+    void TestTaskAllocations()
+    {
+        constexpr size_t batchTasks = 100'000;
+
+        std::atomic<size_t> done = 0;
+        std::atomic<size_t> checksum = 0;
+        size_t expected = 0;
+
+        ThreadPool pool(4);
+
+        auto enqueueBatch = [&](size_t count)
+        {
+            expected += count;
+            for (size_t i = 0; i < count; ++i)
+            {
+                // Six words of state, already too big for the small-buffer
+                // optimization of std::function in libstdc++ and MSVC
+                size_t a = i, b = i * 2, c = i * 3, d = i * 4;
+                pool.Enqueue([&done, &checksum, a, b, c, d]
+                {
+                    checksum.fetch_add(a + b + c + d, std::memory_order_relaxed);
+                    done.fetch_add(1, std::memory_order_release);
+                });
+            }
+        };
+
+        auto waitForBatch = [&]
+        {
+            while (done.load(std::memory_order_acquire) < expected)
+                std::this_thread::yield();
+        };
+
+        // The workers are held back during the first batch, so the queue grows to the
+        // depth of a whole batch and the measured one can't need a bigger buffer
+        std::atomic<bool> release = false;
+        for (size_t i = 0; i < pool.ThreadCount(); ++i)
+            pool.Enqueue([&release] { release.wait(false); });
+        enqueueBatch(batchTasks);
+        release.store(true);
+        release.notify_all();
+        waitForBatch();
+
+        size_t allocations = 0;
+        {
+            HeapAllocationScope heap;
+            enqueueBatch(batchTasks);
+            waitForBatch();
+            allocations = heap.Allocations();
+        }
+
+        // Small captures are stored inline and the queue buffers are reused
+        std::cout << "[ThreadPool] " << batchTasks << " small tasks, "
+                  << allocations << " heap allocations" << std::endl;
+        if (allocations != 0)
+            std::cout << "[ThreadPool] allocation mismatch: small tasks touched the heap" << std::endl;
+
+        // A capture that can't fit is still accepted, it just moves to the heap
+        size_t before = ThreadPool::Task::HeapAllocations();
+        struct Large { char Bytes[THREADS_THREAD_POOL_TASK_CAPACITY * 2] = { }; };
+        static_assert(!ThreadPool::Task::FitsInline<Large>);
+
+        expected += 1;
+        pool.Enqueue([&done, large = Large { }] { if (large.Bytes[0] == 0) done.fetch_add(1); });
+        waitForBatch();
+
+        if (ThreadPool::Task::HeapAllocations() != before + 1)
+            std::cout << "[ThreadPool] allocation mismatch: large capture wasn't moved to the heap" << std::endl;
+    }
+
+    // Prints the NUMA layout and where the workers of a pinned, named pool end up.
+    // On Linux the workers show up as "worker-0", "worker-1", ... in top -H and perf.
+    void TestPoolPlacement()
+    {
+        for (const NumaNode& node : NumaTopology())
+        {
+            std::cout << "[Placement] NUMA node " << node.Id << ":";
+            for (size_t cpu : node.Cpus)
+                std::cout << " " << cpu;
+            std::cout << std::endl;
+        }
+
+        for (AffinityMode affinity : { AffinityMode::Compact, AffinityMode::Scatter })
+        {
+            ThreadPool pool(ThreadPoolOptions
+            {
+                .NumThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1),
+                .Affinity = affinity,
+                .NamePrefix = "worker-"
+            });
+
+            std::mutex mutex;
+            std::vector<int> cpus;
+            pool.SubmitBulk(std::views::iota(size_t(0), pool.ThreadCount() * 4), [&](size_t)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                cpus.push_back(CurrentCpu());
+            }).Get();
+
+            std::sort(cpus.begin(), cpus.end());
+            cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+
+            std::cout << "[Placement] " << (affinity == AffinityMode::Compact ? "Compact" : "Scatter") << " pool ran tasks on CPUs";
+            for (int cpu : cpus)
+                std::cout << " " << cpu;
+            std::cout << std::endl;
+        }
+
+        // Producers on any node feed the workers of their own node
+        NumaThreadPools pools(ThreadPoolOptions { .NamePrefix = "numa" });
+        int cpu = pools.Submit([] { return CurrentCpu(); }).Get();
+        std::cout << "[Placement] " << pools.NodeCount() << " node pools, local task ran on CPU " << cpu << std::endl;
+    }
+
+    void TestSubmit()
+    {
+        ThreadPool pool(4);
+
+        // Results come back through a future, no std::promise plumbing required
+        TaskFuture<int> answer = pool.Submit([](int a, int b) { return a * b; }, 6, 7);
+        TaskFuture<std::string> greeting = pool.Submit([] { return std::string("Hello from the pool"); });
+        TaskFuture<void> failure = pool.Submit([] { throw std::runtime_error("Task failed"); });
+
+        std::cout << "[Submit] 6 * 7 = " << answer.Get() << std::endl;
+        std::cout << "[Submit] " << greeting.Get() << std::endl;
+
+        try
+        {
+            failure.Get();
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "[Submit] Exception rethrown by Get(): " << e.what() << std::endl;
+        }
+
+        // Fan-out over a range with one lock acquisition and one wakeup
+        std::vector<int> values(10'000);
+        pool.SubmitBulk(std::views::iota(size_t(0), values.size()), [&values](size_t i)
+        {
+            values[i] = static_cast<int>(i) * 2;
+        }).Get();
+
+        std::cout << "[SubmitBulk] values[9999] = " << values[9999] << std::endl;
+    }
+
+    void TestPoolLifecycle()
+    {
+        ThreadPool pool(2, SchedulingMode::WorkStealing);
+        std::atomic<int> processed = 0;
+
+        auto work = [&processed]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            processed.fetch_add(1);
+        };
+
+        // Night profile: two workers
+        for (int i = 0; i < 100; ++i)
+            pool.Enqueue(work);
+        pool.WaitIdle();
+        std::cout << "[Lifecycle] " << processed << " tasks on " << pool.ThreadCount() << " threads" << std::endl;
+
+        // Day profile: grow without rebuilding the pool, then shrink back while work
+        // is still queued. The retiring workers hand their queued tasks to the others.
+        pool.Resize(pool.MaxThreadCount());
+        for (int i = 0; i < 100; ++i)
+            pool.Enqueue(work);
+        pool.Resize(2);
+        pool.WaitIdle();
+        std::cout << "[Lifecycle] " << processed << " tasks after resizing back to " << pool.ThreadCount() << " threads" << std::endl;
+
+        // Whatever is still queued at shutdown gets dropped, its futures report broken_promise
+        std::vector<TaskFuture<void>> futures;
+        for (int i = 0; i < 100; ++i)
+            futures.push_back(pool.Submit(work));
+        pool.Shutdown(ShutdownMode::Discard);
+
+        int broken = 0;
+        for (auto& future : futures)
+        {
+            try
+            {
+                future.Get();
+            }
+            catch (const std::future_error&)
+            {
+                ++broken;
+            }
+        }
+        std::cout << "[Lifecycle] Shutdown discarded " << broken << " queued tasks" << std::endl;
+    }
+
+    inline void PrintLaneWaits(const ThreadPool& pool, const char* name, TaskPriority priority)
+    {
+        using Micro = std::chrono::microseconds;
+        LaneStats stats = pool.GetLaneStats(priority);
+
+        // Percentiles are bucket upper bounds, never report more than what was seen
+        auto p50 = std::min(stats.WaitHistogram.Percentile(50), stats.MaxWait);
+        auto p99 = std::min(stats.WaitHistogram.Percentile(99), stats.MaxWait);
+
+        std::cout << "[Priority Lanes] " << name << ": " << stats.Dequeued << " tasks, wait p50 "
+                  << std::chrono::duration_cast<Micro>(p50).count() << " us, p99 "
+                  << std::chrono::duration_cast<Micro>(p99).count() << " us, max "
+                  << std::chrono::duration_cast<Micro>(stats.MaxWait).count() << " us" << std::endl;
+    }
+
+    // Keeps the pool saturated with background work and measures how long realtime
+    // requests wait for a worker. The realtime p99 should stay around one background
+    // task's length, while the background lane still makes progress.
+    void BenchmarkPriorityLanes(SchedulingMode mode = SchedulingMode::GlobalQueue,
+                                std::chrono::milliseconds duration = std::chrono::milliseconds(1000))
+    {
+        using Clock = ThreadPool::Clock;
+
+        auto spinFor = [](std::chrono::microseconds busy)
+        {
+            auto end = Clock::now() + busy;
+            while (Clock::now() < end) { }
+        };
+
+        ThreadPool pool(std::max<size_t>(std::thread::hardware_concurrency(), 1), mode);
+        std::atomic<bool> stop = false;
+
+        // Saturating background load: never let the lane run dry
+        std::thread flooder([&]
+        {
+            while (!stop.load())
+            {
+                if (pool.GetLaneStats(TaskPriority::Background).Depth < 4 * pool.ThreadCount() + 64)
+                    pool.Enqueue(TaskPriority::Background, [&spinFor] { spinFor(std::chrono::microseconds(200)); });
+                else
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        });
+
+        // One short latency-critical request per millisecond
+        auto end = Clock::now() + duration;
+        while (Clock::now() < end)
+        {
+            pool.Enqueue(TaskPriority::Realtime, [&spinFor] { spinFor(std::chrono::microseconds(5)); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        stop.store(true);
+        flooder.join();
+        pool.WaitIdle();
+
+        PrintLaneWaits(pool, "Realtime", TaskPriority::Realtime);
+        PrintLaneWaits(pool, "Background", TaskPriority::Background);
+    }
+
+    // Like BenchmarkPriorityLanes(), but the background lane is flooded at twice the rate
+    // the workers can drain it, so its backlog grows for the whole run and soon consists
+    // of overdue tasks only. Aging must not let that backlog in front of realtime
+    // requests: their p99 should still be about one background task's length.
+    void BenchmarkRealtimeUnderBacklog(SchedulingMode mode = SchedulingMode::GlobalQueue,
+                                       std::chrono::milliseconds duration = std::chrono::milliseconds(1000))
+    {
+        using Clock = ThreadPool::Clock;
+
+        auto spinFor = [](std::chrono::microseconds busy)
+        {
+            auto end = Clock::now() + busy;
+            while (Clock::now() < end) { }
+        };
+
+        ThreadPool pool(std::max<size_t>(std::thread::hardware_concurrency(), 1), mode);
+        std::atomic<bool> stop = false;
+
+        // Every 200 us, two tasks of 200 us per worker: no throttling on the backlog
+        std::thread flooder([&]
+        {
+            while (!stop.load())
+            {
+                for (size_t i = 0; i < 2 * pool.ThreadCount(); ++i)
+                    pool.Enqueue(TaskPriority::Background, [&spinFor] { spinFor(std::chrono::microseconds(200)); });
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+
+        auto end = Clock::now() + duration;
+        while (Clock::now() < end)
+        {
+            pool.Enqueue(TaskPriority::Realtime, [&spinFor] { spinFor(std::chrono::microseconds(5)); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        stop.store(true);
+        flooder.join();
+        const size_t backlog = pool.GetLaneStats(TaskPriority::Background).Depth;
+        pool.Shutdown(ShutdownMode::Discard);
+
+        PrintLaneWaits(pool, "Realtime", TaskPriority::Realtime);
+        PrintLaneWaits(pool, "Background", TaskPriority::Background);
+        std::cout << "[Priority Lanes] Background backlog left: " << backlog << " tasks" << std::endl;
+    }
+
+    // Compares queueing many small tasks one by one with a single SubmitBulk() call
+    void BenchmarkBulkEnqueue(size_t tasksPerRun = 10'000, size_t runs = 100)
+    {
+        ThreadPool pool(std::max<size_t>(std::thread::hardware_concurrency(), 1));
+        std::atomic<size_t> done = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t run = 0; run < runs; ++run)
+        {
+            done.store(0);
+            for (size_t i = 0; i < tasksPerRun; ++i)
+                pool.Enqueue([&done] { done.fetch_add(1, std::memory_order_release); });
+
+            while (done.load(std::memory_order_acquire) < tasksPerRun)
+                std::this_thread::yield();
+        }
+        auto single = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        for (size_t run = 0; run < runs; ++run)
+        {
+            done.store(0);
+            pool.SubmitBulk(std::views::iota(size_t(0), tasksPerRun), [&done](size_t)
+            {
+                done.fetch_add(1, std::memory_order_release);
+            }).Wait();
+        }
+        auto bulk = std::chrono::steady_clock::now() - start;
+
+        using Micro = std::chrono::microseconds;
+        std::cout << "[ThreadPool] " << tasksPerRun << " tasks via Enqueue: "
+                  << std::chrono::duration_cast<Micro>(single).count() / runs << " us per batch" << std::endl;
+        std::cout << "[ThreadPool] " << tasksPerRun << " tasks via SubmitBulk: "
+                  << std::chrono::duration_cast<Micro>(bulk).count() / runs << " us per batch" << std::endl;
+    }
+
+    // Measures how long it takes to push tasks through the pool in both modes.
+    // "external" floods the pool from several producer threads, "fan-out" has the
+    // workers themselves spawn the tasks, which is where local deques shine.
+    void BenchmarkThreadPoolContention(size_t tasksPerRun = 1'000'000)
+    {
+        const size_t numThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+        auto waitFor = [](std::atomic<size_t>& done, size_t expected)
+        {
+            while (done.load(std::memory_order_acquire) < expected)
+                std::this_thread::yield();
+        };
+
+        auto report = [tasksPerRun](const char* mode, const char* scenario, std::chrono::nanoseconds elapsed)
+        {
+            double seconds = std::chrono::duration<double>(elapsed).count();
+            std::cout << "[ThreadPool " << mode << "] " << scenario << ": "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms, "
+                      << static_cast<double>(tasksPerRun) / seconds / 1e6 << " Mtasks/s" << std::endl;
+        };
+
+        for (SchedulingMode mode : { SchedulingMode::GlobalQueue, SchedulingMode::WorkStealing })
+        {
+            const char* modeName = mode == SchedulingMode::GlobalQueue ? "GlobalQueue" : "WorkStealing";
+            ThreadPool pool(numThreads, mode);
+
+            // External producers, one per worker
+            {
+                std::atomic<size_t> done = 0;
+                const size_t perProducer = tasksPerRun / numThreads;
+                const size_t total = perProducer * numThreads;
+
+                auto start = std::chrono::steady_clock::now();
+                std::vector<std::thread> producers;
+                for (size_t p = 0; p < numThreads; ++p)
+                {
+                    producers.emplace_back([&pool, &done, perProducer]
+                    {
+                        for (size_t i = 0; i < perProducer; ++i)
+                            pool.Enqueue([&done] { done.fetch_add(1, std::memory_order_release); });
+                    });
+                }
+                for (auto& producer : producers)
+                    producer.join();
+
+                waitFor(done, total);
+                report(modeName, "external", std::chrono::steady_clock::now() - start);
+            }
+
+            // Fan-out from inside the workers
+            {
+                std::atomic<size_t> done = 0;
+                const size_t perRoot = tasksPerRun / numThreads;
+                const size_t total = perRoot * numThreads;
+
+                auto start = std::chrono::steady_clock::now();
+                for (size_t root = 0; root < numThreads; ++root)
+                {
+                    pool.Enqueue([&pool, &done, perRoot]
+                    {
+                        for (size_t i = 0; i < perRoot; ++i)
+                            pool.Enqueue([&done] { done.fetch_add(1, std::memory_order_release); });
+                    });
+                }
+
+                waitFor(done, total);
+                report(modeName, "fan-out", std::chrono::steady_clock::now() - start);
+            }
+        }
+    }
+
+    // Bursty load: one short task at a time with a pause in between, long enough for
+    // the workers to go idle. Measures the time from Enqueue() until the task starts
+    // running, and the CPU the whole process burnt, for every idle policy.
+    void BenchmarkIdlePolicies(size_t samples = 10'000,
+                               std::chrono::microseconds gap = std::chrono::microseconds(100))
+    {
+        using Clock = ThreadPool::Clock;
+        using Micro = std::chrono::microseconds;
+
+        struct Candidate
+        {
+            const char* Name;
+            IdlePolicy Policy;
+        };
+
+        const Candidate candidates[] =
+        {
+            { "Park", IdlePolicy::Park() },
+            { "Balanced", IdlePolicy::Balanced() },
+            { "Aggressive", IdlePolicy::Aggressive() }
+        };
+
+        for (SchedulingMode mode : { SchedulingMode::GlobalQueue, SchedulingMode::WorkStealing })
+        {
+            const char* modeName = mode == SchedulingMode::GlobalQueue ? "GlobalQueue" : "WorkStealing";
+
+            for (const Candidate& candidate : candidates)
+            {
+                ThreadPool pool(std::max<size_t>(std::thread::hardware_concurrency(), 1), mode, candidate.Policy);
+                LatencyHistogram latency;
+                std::atomic<size_t> done = 0;
+
+                std::clock_t cpuStart = std::clock();
+                auto start = Clock::now();
+                for (size_t i = 0; i < samples; ++i)
+                {
+                    Clock::time_point enqueued = Clock::now();
+                    pool.Enqueue([&latency, &done, enqueued]
+                    {
+                        latency.Record(Clock::now() - enqueued);
+                        done.fetch_add(1, std::memory_order_release);
+                    });
+
+                    while (done.load(std::memory_order_acquire) <= i)
+                        std::this_thread::yield();
+                    std::this_thread::sleep_for(gap);
+                }
+                auto wall = Clock::now() - start;
+                double cpu = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+                HistogramSnapshot snapshot = latency.Snapshot();
+                std::cout << "[Idle " << modeName << "] " << candidate.Name << ": start latency p50 <= "
+                          << std::chrono::duration_cast<Micro>(snapshot.Percentile(50)).count() << " us, p99 <= "
+                          << std::chrono::duration_cast<Micro>(snapshot.Percentile(99)).count() << " us, CPU "
+                          << static_cast<int>(100.0 * cpu / std::chrono::duration<double>(wall).count())
+                          << "% of one core" << std::endl;
+            }
         }
-        return 0;
     }
 }
 
-#endif // THREADS_THREAD_POOL_HPP_
\ No newline at end of file
+#endif // THREADS_THREAD_POOL_HPP_
@@ -0,0 +1,583 @@
+#pragma once
+#ifndef THREADS_TIMER_WHEEL_HPP_
+#define THREADS_TIMER_WHEEL_HPP_
+
+#include "coroutine_executor.hpp"
+#include "latency_histogram.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace Threads
+{
+    class TimerWheel;
+
+    // Intrusive timer for TimerWheel: the wheel links entries into its slots and never
+    // allocates. The owner keeps an entry alive from Schedule() until its Expire() ran,
+    // which happens exactly once per Schedule(), on the timer thread.
+    class TimerEntry
+    {
+    public:
+        TimerEntry() = default;
+        TimerEntry(const TimerEntry&) = delete;
+        TimerEntry& operator=(const TimerEntry&) = delete;
+
+    protected:
+        ~TimerEntry() = default;
+
+        // fired is false when the timer was cancelled, or the wheel shut down, first
+        virtual void Expire(bool fired) = 0;
+
+    private:
+        friend class TimerWheel;
+
+        enum class State : uint8_t
+        {
+            Idle,
+            // Cancelled before it was scheduled: the next Schedule() completes it right away
+            CancelRequested,
+            Pending,
+            Done
+        };
+
+        TimerEntry* m_prev = nullptr;
+        TimerEntry* m_next = nullptr;
+        uint64_t m_deadline = 0;
+        State m_state = State::Idle;
+        bool m_fired = false;
+        uint8_t m_level = 0;
+        uint8_t m_slot = 0;
+    };
+
+    // Hierarchical timer wheel (Varghese and Lauck) driven by one thread. Level 0 has a
+    // slot per tick for the next 256 ticks, each level above covers 256 times the range
+    // of the one below with the same number of slots; four levels reach 2^32 ticks, about
+    // 49 days at the default millisecond tick. Later deadlines wait in the last level and
+    // are re-inserted when they come up.
+    //
+    // Schedule() and Cancel() are O(1): pick a level from the distance to the deadline,
+    // then link into or out of a slot list. Once every 256 ticks the next slot of the level
+    // above is cascaded down; with many timers that slot is large, and relinking it is
+    // where most of the firing jitter comes from. The timer thread sleeps until the next
+    // occupied level 0 slot or cascade, never polling while nothing is due.
+    //
+    // Timers fire at tick granularity and never early: a deadline is rounded up to the next
+    // tick. Expire() runs on the timer thread, so keep it short or hand the work off.
+    class TimerWheel
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit TimerWheel(Clock::duration tick = std::chrono::milliseconds(1))
+            : m_tick(tick), m_start(Clock::now())
+        {
+            m_thread = std::thread([this] { run(); });
+        }
+
+        // Timers still pending expire with fired == false
+        ~TimerWheel()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_wakeup.notify_one();
+            m_thread.join();
+        }
+
+        TimerWheel(const TimerWheel&) = delete;
+        TimerWheel& operator=(const TimerWheel&) = delete;
+
+        static TimerWheel& Global()
+        {
+            static TimerWheel wheel;
+            return wheel;
+        }
+
+        void Schedule(TimerEntry& entry, Clock::time_point deadline)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            assert(entry.m_state != TimerEntry::State::Pending);
+
+            bool wake = false;
+            if (entry.m_state == TimerEntry::State::CancelRequested || m_stop)
+            {
+                wake = !m_readyHead;
+                makeReady(entry, false);
+            }
+            else
+            {
+                // Nothing in the wheel: the ticks slept through need no processing
+                if (m_pending == 0)
+                    m_current = std::max(m_current, elapsedTicks(Clock::now()));
+
+                entry.m_deadline = toTick(deadline);
+                entry.m_state = TimerEntry::State::Pending;
+                insert(entry);
+                ++m_pending;
+
+                // Only wake the timer thread if it sleeps past the new deadline
+                if (entry.m_deadline < m_wakeTick)
+                {
+                    m_wakeTick = entry.m_deadline;
+                    wake = true;
+                }
+            }
+
+            lock.unlock();
+            if (wake)
+                m_wakeup.notify_one();
+        }
+
+        // True if the timer was pending; its Expire(false) follows on the timer thread.
+        // Cancelling an entry that isn't scheduled yet cancels its next Schedule(), so a
+        // cancellation racing with scheduling isn't lost.
+        bool Cancel(TimerEntry& entry)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (entry.m_state == TimerEntry::State::Idle)
+            {
+                entry.m_state = TimerEntry::State::CancelRequested;
+                return false;
+            }
+            if (entry.m_state != TimerEntry::State::Pending)
+                return false;
+
+            unlink(entry);
+            --m_pending;
+            // The timer thread was already woken for the entries ahead of this one
+            const bool wake = !m_readyHead;
+            makeReady(entry, false);
+
+            lock.unlock();
+            if (wake)
+                m_wakeup.notify_one();
+            return true;
+        }
+
+        size_t PendingCount() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_pending;
+        }
+
+        Clock::duration Tick() const { return m_tick; }
+
+    private:
+        static constexpr size_t LevelBits = 8;
+        static constexpr size_t SlotCount = size_t(1) << LevelBits;
+        static constexpr size_t SlotMask = SlotCount - 1;
+        static constexpr size_t LevelCount = 4;
+        static constexpr uint64_t MaxDelta = (uint64_t(1) << (LevelBits * LevelCount)) - 1;
+
+        // Rounded up: a timer never fires before its deadline
+        uint64_t toTick(Clock::time_point deadline) const
+        {
+            if (deadline <= m_start)
+                return 0;
+            return static_cast<uint64_t>((deadline - m_start + m_tick - Clock::duration(1)) / m_tick);
+        }
+
+        uint64_t elapsedTicks(Clock::time_point now) const
+        {
+            return now <= m_start ? 0 : static_cast<uint64_t>((now - m_start) / m_tick);
+        }
+
+        void insert(TimerEntry& entry)
+        {
+            const uint64_t delta = std::min(std::max(entry.m_deadline, m_current) - m_current, MaxDelta);
+            const size_t level = delta == 0 ? 0 : (std::bit_width(delta) - 1) / LevelBits;
+            const size_t slot = ((m_current + delta) >> (LevelBits * level)) & SlotMask;
+
+            TimerEntry*& head = m_slots[level][slot];
+            entry.m_prev = nullptr;
+            entry.m_next = head;
+            if (head)
+                head->m_prev = &entry;
+            head = &entry;
+            entry.m_level = static_cast<uint8_t>(level);
+            entry.m_slot = static_cast<uint8_t>(slot);
+            if (level == 0)
+                m_occupied[slot / 64] |= uint64_t(1) << (slot % 64);
+        }
+
+        void unlink(TimerEntry& entry)
+        {
+            if (entry.m_prev)
+                entry.m_prev->m_next = entry.m_next;
+            else
+                m_slots[entry.m_level][entry.m_slot] = entry.m_next;
+            if (entry.m_next)
+                entry.m_next->m_prev = entry.m_prev;
+
+            if (entry.m_level == 0 && !m_slots[0][entry.m_slot])
+                m_occupied[entry.m_slot / 64] &= ~(uint64_t(1) << (entry.m_slot % 64));
+        }
+
+        TimerEntry* takeSlot(size_t level, size_t slot)
+        {
+            TimerEntry* entries = std::exchange(m_slots[level][slot], nullptr);
+            if (level == 0)
+                m_occupied[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+            return entries;
+        }
+
+        void makeReady(TimerEntry& entry, bool fired)
+        {
+            entry.m_state = TimerEntry::State::Done;
+            entry.m_fired = fired;
+            entry.m_next = nullptr;
+            if (m_readyTail)
+                m_readyTail->m_next = &entry;
+            else
+                m_readyHead = &entry;
+            m_readyTail = &entry;
+        }
+
+        // Processes tick m_current
+        void advance()
+        {
+            const size_t index = m_current & SlotMask;
+            if (index == 0)
+            {
+                // Level 0 wrapped: spread the next slot of the level above over level 0,
+                // and so on up while those wrap too
+                for (size_t level = 1; level < LevelCount; ++level)
+                {
+                    const size_t slot = (m_current >> (LevelBits * level)) & SlotMask;
+                    for (TimerEntry* entry = takeSlot(level, slot); entry;)
+                    {
+                        TimerEntry* next = entry->m_next;
+                        insert(*entry);
+                        entry = next;
+                    }
+                    if (slot != 0)
+                        break;
+                }
+            }
+
+            for (TimerEntry* entry = takeSlot(0, index); entry;)
+            {
+                TimerEntry* next = entry->m_next;
+                if (entry->m_deadline > m_current)
+                {
+                    // Beyond the wheel's range when scheduled
+                    insert(*entry);
+                }
+                else
+                {
+                    --m_pending;
+                    makeReady(*entry, true);
+                }
+                entry = next;
+            }
+            ++m_current;
+        }
+
+        // The next tick worth waking up for: an occupied level 0 slot, or the next cascade,
+        // which may be the current tick itself
+        uint64_t nextEventTick() const
+        {
+            const size_t index = m_current & SlotMask;
+            if (index == 0)
+                return m_current;
+            for (size_t word = index / 64; word < m_occupied.size(); ++word)
+            {
+                uint64_t bits = m_occupied[word];
+                if (word == index / 64)
+                    bits &= ~uint64_t(0) << (index % 64);
+                if (bits)
+                    return m_current - index + word * 64 + static_cast<size_t>(std::countr_zero(bits));
+            }
+            return (m_current | SlotMask) + 1;
+        }
+
+        void cancelAll()
+        {
+            for (auto& level : m_slots)
+            {
+                for (size_t slot = 0; slot < SlotCount; ++slot)
+                {
+                    for (TimerEntry* entry = level[slot]; entry;)
+                    {
+                        TimerEntry* next = entry->m_next;
+                        makeReady(*entry, false);
+                        entry = next;
+                    }
+                    level[slot] = nullptr;
+                }
+            }
+            m_occupied = { };
+            m_pending = 0;
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true)
+            {
+                const uint64_t now = elapsedTicks(Clock::now());
+                if (m_pending == 0)
+                    m_current = std::max(m_current, now + 1);
+                while (m_current <= now && m_pending > 0)
+                    advance();
+                if (m_stop)
+                    cancelAll();
+
+                if (m_readyHead)
+                {
+                    TimerEntry* entry = std::exchange(m_readyHead, nullptr);
+                    m_readyTail = nullptr;
+                    lock.unlock();
+                    // The entry may be gone once Expire() returns
+                    while (entry)
+                    {
+                        TimerEntry* next = entry->m_next;
+                        entry->Expire(entry->m_fired);
+                        entry = next;
+                    }
+                    lock.lock();
+                    continue;
+                }
+                if (m_stop)
+                    break;
+
+                if (m_pending == 0)
+                {
+                    m_wakeTick = UINT64_MAX;
+                    m_wakeup.wait(lock);
+                }
+                else
+                {
+                    m_wakeTick = nextEventTick();
+                    m_wakeup.wait_until(lock, m_start + m_tick * static_cast<Clock::rep>(m_wakeTick));
+                }
+            }
+        }
+
+        const Clock::duration m_tick;
+        const Clock::time_point m_start;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_wakeup;
+        std::array<std::array<TimerEntry*, SlotCount>, LevelCount> m_slots = { };
+        // Occupied level 0 slots, to find the next one to wake up for
+        std::array<uint64_t, SlotCount / 64> m_occupied = { };
+        // Every tick before this one has been processed
+        uint64_t m_current = 0;
+        uint64_t m_wakeTick = UINT64_MAX;
+        size_t m_pending = 0;
+        TimerEntry* m_readyHead = nullptr;
+        TimerEntry* m_readyTail = nullptr;
+        bool m_stop = false;
+
+        std::thread m_thread;
+    };
+
+    // co_await SleepFor(...) suspends the coroutine without holding a thread; when the
+    // timer expires it is resumed as a task on the given pool, so the timer thread never
+    // runs coroutine bodies. Yields true once the time is up, false if the stop token was
+    // triggered first.
+    class SleepAwaiter : public TimerEntry
+    {
+    public:
+        SleepAwaiter(TimerWheel& wheel, ThreadPool& pool, TimerWheel::Clock::time_point deadline, std::stop_token token)
+            : m_wheel(wheel), m_pool(pool), m_deadline(deadline), m_token(std::move(token))
+        {
+        }
+
+        bool await_ready()
+        {
+            if (m_token.stop_requested())
+            {
+                m_completed = false;
+                return true;
+            }
+            return m_deadline <= TimerWheel::Clock::now();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            // A stop request from here on cancels the timer, even before it is scheduled.
+            // Scheduling comes last: the coroutine may be resumed before it returns.
+            if (m_token.stop_possible())
+                m_onStop.emplace(m_token, CancelSleep { this });
+            m_wheel.Schedule(*this, m_deadline);
+        }
+
+        bool await_resume() const noexcept { return m_completed; }
+
+    protected:
+        void Expire(bool fired) override
+        {
+            m_completed = fired;
+            // Waits for a stop callback running right now on another thread
+            m_onStop.reset();
+            // The awaiter lives in the coroutine frame: don't touch it once the task is queued
+            m_pool.Enqueue([handle = m_handle] { handle.resume(); });
+        }
+
+    private:
+        struct CancelSleep
+        {
+            SleepAwaiter* Awaiter;
+            void operator()() const noexcept { Awaiter->m_wheel.Cancel(*Awaiter); }
+        };
+
+        TimerWheel& m_wheel;
+        ThreadPool& m_pool;
+        TimerWheel::Clock::time_point m_deadline;
+        std::stop_token m_token;
+        std::optional<std::stop_callback<CancelSleep>> m_onStop;
+        std::coroutine_handle<> m_handle;
+        bool m_completed = true;
+    };
+
+    // The pool has to outlive the sleep, it is where the coroutine continues
+    inline SleepAwaiter SleepUntil(ThreadPool& pool, TimerWheel::Clock::time_point deadline, std::stop_token token = { })
+    {
+        return SleepAwaiter(TimerWheel::Global(), pool, deadline, std::move(token));
+    }
+
+    inline SleepAwaiter SleepUntil(TimerWheel::Clock::time_point deadline, std::stop_token token = { })
+    {
+        // Touched before the global wheel, so on a first sleep the pool outlives the wheel
+        ThreadPool& pool = Coroutines::DefaultPool();
+        return SleepUntil(pool, deadline, std::move(token));
+    }
+
+    template <typename Rep, typename Period>
+    SleepAwaiter SleepFor(ThreadPool& pool, std::chrono::duration<Rep, Period> duration, std::stop_token token = { })
+    {
+        return SleepUntil(pool, TimerWheel::Clock::now() + std::chrono::ceil<TimerWheel::Clock::duration>(duration), std::move(token));
+    }
+
+    template <typename Rep, typename Period>
+    SleepAwaiter SleepFor(std::chrono::duration<Rep, Period> duration, std::stop_token token = { })
+    {
+        ThreadPool& pool = Coroutines::DefaultPool();
+        return SleepFor(pool, duration, std::move(token));
+    }
+
+    Coroutines::Task<bool> SleepThenReport(std::chrono::milliseconds duration, std::stop_token token)
+    {
+        co_return co_await SleepFor(duration, std::move(token));
+    }
+
+    // A million timers spread over two seconds, a quarter of them cancelled again: insert and
+    // cancel cost, memory per timer and how late the others fire. Then coroutines sleep on
+    // the global wheel while a stop_source cancels half of them.
+    void BenchmarkTimerWheel(size_t timers = 1'000'000, std::chrono::milliseconds spread = std::chrono::milliseconds(2000))
+    {
+        using Clock = TimerWheel::Clock;
+
+        struct BenchTimer : TimerEntry
+        {
+            Clock::time_point Deadline;
+            LatencyHistogram* Lateness = nullptr;
+            std::atomic<size_t>* Completed = nullptr;
+            std::atomic<int64_t>* LatestNs = nullptr;
+
+            void Expire(bool fired) override
+            {
+                if (fired)
+                {
+                    auto late = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - Deadline);
+                    Lateness->Record(late);
+                    if (late.count() > LatestNs->load(std::memory_order_relaxed))
+                        LatestNs->store(late.count(), std::memory_order_relaxed);
+                }
+                Completed->fetch_add(1, std::memory_order_release);
+            }
+        };
+
+        LatencyHistogram lateness;
+        std::atomic<size_t> completed = 0;
+        std::atomic<int64_t> latestNs = 0;
+        auto entries = std::make_unique<BenchTimer[]>(timers);
+        {
+            TimerWheel wheel;
+
+            // Deadlines at nanosecond resolution, so rounding up to the tick shows as lateness
+            uint64_t seed = 0x9e3779b97f4a7c15;
+            const Clock::time_point base = Clock::now() + std::chrono::milliseconds(100);
+            const uint64_t spreadNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(spread).count());
+
+            auto start = Clock::now();
+            for (size_t i = 0; i < timers; ++i)
+            {
+                seed = seed * 6364136223846793005 + 1442695040888963407;
+                BenchTimer& entry = entries[i];
+                entry.Deadline = base + std::chrono::nanoseconds((seed >> 16) % spreadNs);
+                entry.Lateness = &lateness;
+                entry.Completed = &completed;
+                entry.LatestNs = &latestNs;
+                wheel.Schedule(entry, entry.Deadline);
+            }
+            double insertNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(timers);
+
+            start = Clock::now();
+            size_t cancelled = 0;
+            for (size_t i = 0; i < timers; i += 4)
+                cancelled += wheel.Cancel(entries[i]) ? 1 : 0;
+            double cancelNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>((timers + 3) / 4);
+
+            while (completed.load(std::memory_order_acquire) < timers)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            HistogramSnapshot snapshot = lateness.Snapshot();
+            auto us = [](std::chrono::nanoseconds ns) { return std::chrono::duration_cast<std::chrono::microseconds>(ns).count(); };
+            std::cout << "[TimerWheel] " << timers << " timers: insert " << insertNs << " ns, cancel " << cancelNs << " ns ("
+                      << cancelled << " cancelled)" << std::endl;
+            std::cout << "[TimerWheel] memory: " << sizeof(TimerEntry) << " bytes of wheel links per timer, "
+                      << sizeof(TimerWheel) / 1024 << " KiB of slots, one thread; a thread per timer would be "
+                      << timers << " threads" << std::endl;
+            std::cout << "[TimerWheel] lateness with a " << us(wheel.Tick()) << " us tick: p50 <= " << us(snapshot.Percentile(50))
+                      << " us, p99 <= " << us(snapshot.Percentile(99)) << " us, p99.9 <= " << us(snapshot.Percentile(99.9))
+                      << " us, max " << latestNs.load() / 1000 << " us" << std::endl;
+        }
+
+        const size_t sleepers = std::min<size_t>(timers, 10'000);
+        std::stop_source stop;
+        std::vector<Coroutines::Task<bool>> tasks;
+        tasks.reserve(sleepers);
+        for (size_t i = 0; i < sleepers; ++i)
+        {
+            // Odd sleepers share the stop_source, even ones can't be stopped
+            std::stop_token token = i % 2 ? stop.get_token() : std::stop_token();
+            tasks.push_back(SleepThenReport(std::chrono::milliseconds(50 + i % 50), std::move(token)));
+        }
+
+        std::thread canceller([&stop]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            stop.request_stop();
+        });
+        auto start = Clock::now();
+        std::vector<bool> results = Coroutines::SyncWait(Coroutines::WhenAll(std::move(tasks)));
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+        canceller.join();
+
+        size_t completedSleeps = static_cast<size_t>(std::count(results.begin(), results.end(), true));
+        assert(completedSleeps == (sleepers + 1) / 2);
+        std::cout << "[TimerWheel] " << sleepers << " sleeping coroutines: " << completedSleeps << " slept, "
+                  << sleepers - completedSleeps << " cancelled, all done in " << elapsed.count() << " ms" << std::endl;
+    }
+}
+
+#endif // THREADS_TIMER_WHEEL_HPP_